@@ -0,0 +1,327 @@
+/*
+ * Load generator for /dev/chdev.
+ *
+ * Every thread opens its own session with its own work file and pushes
+ * generated numeric text through write() or the batch ioctl. Reports
+ * throughput and the latency distribution of the syscalls.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uapi.h"
+
+
+enum bench_mode {
+    MODE_WRITE,
+    MODE_IOCTL,
+};
+
+static struct {
+    const char *dev;
+    const char *workdir;
+    enum bench_mode mode;
+    unsigned int threads;
+    size_t write_sz;
+    unsigned int density;   /* percent of digit bytes */
+    unsigned long ops;      /* per thread */
+    unsigned int commit_every;
+    unsigned int batch;
+} cfg = {
+    .dev = "/dev/chdev",
+    .workdir = "/tmp",
+    .mode = MODE_WRITE,
+    .threads = 1,
+    .write_sz = 4096,
+    .density = 80,
+    .ops = 100000,
+    .commit_every = 1,
+    .batch = 16,
+};
+
+struct worker {
+    pthread_t tid;
+    unsigned int id;
+    uint64_t *lat_ns;       /* one sample per write(), commit or ioctl() */
+    unsigned long nsamples;
+    uint64_t bytes;
+    int err;
+};
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/* Numbers of random length separated by single spaces */
+static void fill_input(char *buf, size_t sz, unsigned int density, unsigned int seed)
+{
+    size_t i = 0;
+
+    for (i = 0; i < sz; i++) {
+        if ((unsigned int)rand_r(&seed) % 100 < density)
+            buf[i] = '0' + rand_r(&seed) % 10;
+        else
+            buf[i] = ' ';
+    }
+}
+
+
+static int send_cmd(int fd, const char *cmd)
+{
+    size_t len = strlen(cmd);
+
+    return write(fd, cmd, len) == (ssize_t)len ? 0 : -errno;
+}
+
+
+static int run_write(struct worker *w, int fd, const char *input)
+{
+    unsigned long i = 0;
+
+    for (i = 0; i < cfg.ops; i++) {
+        uint64_t start = now_ns();
+
+        if (write(fd, input, cfg.write_sz) != (ssize_t)cfg.write_sz)
+            return -errno;
+        w->lat_ns[w->nsamples++] = now_ns() - start;
+        w->bytes += cfg.write_sz;
+
+        if ((i + 1) % cfg.commit_every)
+            continue;
+
+        start = now_ns();
+        if (send_cmd(fd, "commit"))
+            return -errno;
+        w->lat_ns[w->nsamples++] = now_ns() - start;
+    }
+    return 0;
+}
+
+
+static int run_ioctl(struct worker *w, int fd, const char *input)
+{
+    struct chdev_op *ops = calloc(cfg.batch, sizeof(*ops));
+    struct chdev_batch batch = { .ops = (uintptr_t)ops };
+    unsigned long i = 0;
+    unsigned int j = 0;
+    int err = 0;
+
+    if (!ops)
+        return -ENOMEM;
+
+    for (i = 0; i < cfg.ops && !err; i += cfg.batch) {
+        uint64_t start = 0;
+
+        batch.count = cfg.batch < cfg.ops - i ? cfg.batch : cfg.ops - i;
+        for (j = 0; j < batch.count; j++) {
+            ops[j].code = CHDEV_OP_SUM;
+            ops[j].addr = (uintptr_t)input;
+            ops[j].len = cfg.write_sz;
+        }
+
+        start = now_ns();
+        if (ioctl(fd, CHDEV_IOC_BATCH, &batch))
+            err = -errno;
+
+        w->lat_ns[w->nsamples++] = now_ns() - start;
+        w->bytes += (uint64_t)batch.done * cfg.write_sz;
+    }
+
+    free(ops);
+    return err;
+}
+
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    char cmd[64 + 4096];
+    char *input = NULL;
+    int fd = -1;
+
+    input = malloc(cfg.write_sz);
+    if (!input) {
+        w->err = -ENOMEM;
+        return NULL;
+    }
+    fill_input(input, cfg.write_sz, cfg.density, w->id + 1);
+
+    fd = open(cfg.dev, O_RDWR);
+    if (fd < 0) {
+        w->err = -errno;
+        goto out;
+    }
+
+    snprintf(cmd, sizeof(cmd), "open %s/chdev_bench.%u", cfg.workdir, w->id);
+    if ((w->err = send_cmd(fd, cmd)))
+        goto out;
+
+    if (cfg.mode == MODE_IOCTL)
+        w->err = run_ioctl(w, fd, input);
+    else
+        w->err = run_write(w, fd, input);
+
+    if (!w->err)
+        w->err = send_cmd(fd, "close");
+
+out:
+    if (fd >= 0)
+        close(fd);
+    free(input);
+    return NULL;
+}
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, double p)
+{
+    size_t idx = (size_t)(p * (n - 1));
+
+    return n ? sorted[idx] : 0;
+}
+
+
+static void report(struct worker *workers, uint64_t elapsed_ns)
+{
+    uint64_t *all = NULL;
+    uint64_t bytes = 0;
+    size_t n = 0;
+    unsigned int t = 0;
+    double secs = elapsed_ns / 1e9;
+
+    for (t = 0; t < cfg.threads; t++) {
+        n += workers[t].nsamples;
+        bytes += workers[t].bytes;
+    }
+
+    all = malloc((n ? n : 1) * sizeof(*all));
+    if (!all) {
+        perror("malloc");
+        return;
+    }
+    for (n = 0, t = 0; t < cfg.threads; t++) {
+        memcpy(all + n, workers[t].lat_ns, workers[t].nsamples * sizeof(*all));
+        n += workers[t].nsamples;
+    }
+    qsort(all, n, sizeof(*all), cmp_u64);
+
+    printf("mode %s, threads %u, write size %zu, digits %u%%\n",
+           cfg.mode == MODE_IOCTL ? "ioctl" : "write",
+           cfg.threads, cfg.write_sz, cfg.density);
+    printf("throughput: %.1f MB/s, %.0f syscalls/s\n",
+           bytes / secs / 1e6, n / secs);
+    printf("syscall latency ns: p50 %llu, p99 %llu, p999 %llu, max %llu\n",
+           (unsigned long long)percentile(all, n, 0.50),
+           (unsigned long long)percentile(all, n, 0.99),
+           (unsigned long long)percentile(all, n, 0.999),
+           (unsigned long long)(n ? all[n - 1] : 0));
+    free(all);
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -D path   device (%s)\n"
+            "  -w dir    directory for work files (%s)\n"
+            "  -m mode   write or ioctl (write)\n"
+            "  -t n      threads, each with its own session (%u)\n"
+            "  -s bytes  size of a write or of a SUM buffer (%zu)\n"
+            "  -d pct    percent of digit bytes in the input (%u)\n"
+            "  -n ops    writes or SUM operations per thread (%lu)\n"
+            "  -c n      write mode: commit after every n writes (%u)\n"
+            "  -b n      ioctl mode: operations per batch (%u)\n",
+            prog, cfg.dev, cfg.workdir, cfg.threads, cfg.write_sz,
+            cfg.density, cfg.ops, cfg.commit_every, cfg.batch);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct worker *workers = NULL;
+    uint64_t start = 0;
+    unsigned int t = 0;
+    int ret = 0;
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "D:w:m:t:s:d:n:c:b:h")) != -1) {
+        switch (opt) {
+            case 'D': cfg.dev = optarg; break;
+            case 'w': cfg.workdir = optarg; break;
+            case 'm': cfg.mode = strcmp(optarg, "ioctl") ? MODE_WRITE : MODE_IOCTL; break;
+            case 't': cfg.threads = strtoul(optarg, NULL, 0); break;
+            case 's': cfg.write_sz = strtoul(optarg, NULL, 0); break;
+            case 'd': cfg.density = strtoul(optarg, NULL, 0); break;
+            case 'n': cfg.ops = strtoul(optarg, NULL, 0); break;
+            case 'c': cfg.commit_every = strtoul(optarg, NULL, 0); break;
+            case 'b': cfg.batch = strtoul(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!cfg.threads || !cfg.write_sz || !cfg.ops || !cfg.commit_every || !cfg.batch
+        || cfg.density > 100) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    workers = calloc(cfg.threads, sizeof(*workers));
+    if (!workers) {
+        perror("calloc");
+        return 1;
+    }
+    for (t = 0; t < cfg.threads; t++) {
+        workers[t].id = t;
+        // Room for a commit after every write
+        workers[t].lat_ns = malloc(2 * cfg.ops * sizeof(uint64_t));
+        if (!workers[t].lat_ns) {
+            perror("malloc");
+            return 1;
+        }
+    }
+
+    start = now_ns();
+    for (t = 0; t < cfg.threads; t++)
+        pthread_create(&workers[t].tid, NULL, worker_main, &workers[t]);
+    for (t = 0; t < cfg.threads; t++)
+        pthread_join(workers[t].tid, NULL);
+
+    report(workers, now_ns() - start);
+
+    for (t = 0; t < cfg.threads; t++) {
+        if (workers[t].err) {
+            fprintf(stderr, "thread %u: %s\n", t, strerror(-workers[t].err));
+            ret = 1;
+        }
+        free(workers[t].lat_ns);
+    }
+    free(workers);
+    return ret;
+}
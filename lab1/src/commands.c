@@ -1,9 +1,38 @@
 #include "commands.h"
 
 
-bool str_contains(const char *str, const char* substr)
+/* Decimal form of the 128-bit number hi:lo, returns its length */
+int u128_to_str(char *buf, size_t size, u64 hi, u64 lo)
 {
-    return strstr(str, substr) != NULL;
+    u32 limbs[4] = { hi >> 32, (u32)hi, lo >> 32, (u32)lo };
+    u32 groups[5];
+    int ngroups = 0;
+    int len = 0;
+
+    if (!hi)
+        return snprintf(buf, size, "%llu", lo);
+
+    // Long division by 10^9, 32 bits at a time
+    for (;;) {
+        u64 rem = 0;
+        bool zero = true;
+        int i = 0;
+
+        for (i = 0; i < 4; i++) {
+            u64 cur = (rem << 32) | limbs[i];
+            rem = do_div(cur, 1000000000);
+            limbs[i] = cur;
+            zero = zero && !limbs[i];
+        }
+        groups[ngroups++] = rem;
+        if (zero)
+            break;
+    }
+
+    len = snprintf(buf, size, "%u", groups[--ngroups]);
+    while (ngroups-- && len < size)
+        len += snprintf(buf + len, size - len, "%09u", groups[ngroups]);
+    return len;
 }
 
 
@@ -41,7 +70,7 @@ void kfile_close(struct file *fp)
 
 
 ssize_t kfile_write(struct file *file, 
-                    unsigned long long* offset, 
+                    loff_t *offset, 
                     const char *data, 
                     size_t size)
 {
@@ -58,7 +87,7 @@ ssize_t kfile_write(struct file *file,
 
 
 ssize_t kfile_read(struct file *file, 
-                   unsigned long long* offset, 
+                   loff_t *offset, 
                    char *data, 
                    size_t size)
 {
@@ -13,15 +13,17 @@
 #include <linux/string.h>
 #include <linux/syscalls.h>
 #include <linux/buffer_head.h>
+#include <linux/poll.h>
+#include <linux/math64.h>
 #include <asm/uaccess.h>
 
 
 struct file *kfile_open(const char *fname, mode_t mode);
 void kfile_close(struct file *fp);
-ssize_t kfile_write(struct file *file, unsigned long long* offset, const char *data, size_t size);
-ssize_t kfile_read(struct file *file, unsigned long long* offset, char *data, size_t size);
+ssize_t kfile_write(struct file *file, loff_t *offset, const char *data, size_t size);
+ssize_t kfile_read(struct file *file, loff_t *offset, char *data, size_t size);
 
 char* str_copy_ks(char *kstr, const char __user *buf, size_t buflen);
-bool str_contains(const char *str, const char* substr);
+int u128_to_str(char *buf, size_t size, u64 hi, u64 lo);
 
 #endif
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef CDEV_CONSTANTS_H
+#define CDEV_CONSTANTS_H
+
 #include <linux/module.h>
 #include <linux/version.h>
 #include <linux/kernel.h>
@@ -29,6 +32,26 @@
 #define DRV_CMD_CLOSE "close"
 #define DRV_CMD_CLOSE_STRLEN (sizeof(DRV_CMD_CLOSE) - 1))
 
+#define DRV_CMD_COMMIT "commit"
+#define DRV_CMD_SYNC "sync"
+
+#define DRV_CMD_AGGR "aggr "
+#define DRV_CMD_AGGR_STRLEN (sizeof(DRV_CMD_AGGR) - 1)
+
+// Longest write() that is checked for being a command
+#define DRV_CMD_MAX_LEN (DRV_CMD_OPEN_STRLEN + PATH_MAX)
+
 #define DRV_WORKFILE_PERM 0666
-#define DRV_READBUF_SZ 513
+#define DRV_WRITE_CHUNK_SZ (4 * PAGE_SIZE)
+#define DRV_RING_SLOTS 4096
+
+// "sum=<39 digits> count=<20> min=<20> max=<20> skipped=<20>\n"
+#define DRV_RESULT_LINE_MAX 192
+
+#define DRV_WB_FLUSH_BYTES 2048
+#define DRV_WB_DELAY_MS 100
+
+// Operations of an ioctl batch copied in at once
+#define DRV_BATCH_CHUNK 8
 
+#endif
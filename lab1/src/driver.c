@@ -1,5 +1,7 @@
 #include "commands.h"
 #include "constants.h"
+#include "session.h"
+#include "uapi.h"
 
 
 /* Module scope variables */
@@ -7,22 +9,20 @@ static struct {
     dev_t dev;
     struct cdev cdev;
     struct class* cl;
-    struct file* workfile_fp;
-} mscope = {
-    .workfile_fp = NULL,
-};
+} mscope;
 
 
-static int chdev_open(struct inode *ip, struct file *fp)
-{
-    return DRV_SUCCESS;
-}
+static unsigned int ring_slots = DRV_RING_SLOTS;
+module_param(ring_slots, uint, 0444);
+MODULE_PARM_DESC(ring_slots, "Number of results kept in the mmap()'able ring");
 
+static unsigned int wb_flush_bytes = DRV_WB_FLUSH_BYTES;
+module_param(wb_flush_bytes, uint, 0644);
+MODULE_PARM_DESC(wb_flush_bytes, "Staged result bytes that trigger a work file write");
 
-static int chdev_release(struct inode *ip, struct file *fp)
-{
-    return DRV_SUCCESS;
-}
+static unsigned int wb_delay_ms = DRV_WB_DELAY_MS;
+module_param(wb_delay_ms, uint, 0644);
+MODULE_PARM_DESC(wb_delay_ms, "Longest time a result stays staged before it is written");
 
 
 // Log message prefixes
@@ -41,222 +41,639 @@ static int chdev_release(struct inode *ip, struct file *fp)
 #define WRITE_CMD_ERR DRV_LOG_WR_INFO WRITE_LOG_PREFIX 
 #define WRITE_CMD_DBG DRV_LOG_WR_DBG WRITE_LOG_PREFIX 
 
+#define COMMIT_LOG_PREFIX "commit(): "
+#define COMMIT_CMD_INFO DRV_LOG_WR_INFO COMMIT_LOG_PREFIX
+#define COMMIT_CMD_ERR DRV_LOG_WR_INFO COMMIT_LOG_PREFIX
+#define COMMIT_CMD_DBG DRV_LOG_WR_DBG COMMIT_LOG_PREFIX
+
+#define SYNC_LOG_PREFIX "sync(): "
+#define SYNC_CMD_INFO DRV_LOG_WR_INFO SYNC_LOG_PREFIX
+#define SYNC_CMD_ERR DRV_LOG_WR_INFO SYNC_LOG_PREFIX
+#define SYNC_CMD_DBG DRV_LOG_WR_DBG SYNC_LOG_PREFIX
+
+#define AGGR_LOG_PREFIX "aggr(): "
+#define AGGR_CMD_INFO DRV_LOG_WR_INFO AGGR_LOG_PREFIX
+#define AGGR_CMD_ERR DRV_LOG_WR_INFO AGGR_LOG_PREFIX
+#define AGGR_CMD_DBG DRV_LOG_WR_DBG AGGR_LOG_PREFIX
+
+#define RING_ACK_LOG_PREFIX "ring_ack(): "
+#define RING_ACK_CMD_ERR DRV_LOG_WR_INFO RING_ACK_LOG_PREFIX
+
 #define READ_LOG_PREFIX "read(): "
 #define READ_CMD_INFO DRV_LOG_INFO READ_LOG_PREFIX
 #define READ_CMD_ERR DRV_LOG_INFO READ_LOG_PREFIX 
 #define READ_CMD_DBG DRV_LOG_DBG READ_LOG_PREFIX 
 
 
-static void str_replace(char *str, char a, char b)
+static bool workfile_readable(struct file *wf, loff_t pos)
 {
-    do {
-        if (*str == a)
-            *str = b;
-    } while (*str++);
+    return pos < i_size_read(file_inode(wf));
 }
 
 
-static ssize_t chdev_read(struct file *fp, 
-                          char __user *buf, 
-                          size_t len, 
-                          loff_t* off)
+/*
+ * Sleeps until results show up past pos or the session's work file is
+ * closed. Results of every session wake the waiters, so a consumer may
+ * follow a work file that other processes produce.
+ */
+static int wait_for_results(struct file *fp, struct file *wf, loff_t pos)
 {
-    loff_t offset = 0;
-    char *kbuf = NULL;
-    if (!mscope.workfile_fp) {
-        printk(READ_CMD_ERR "Could not read from file. File is not open");
-        return len;
-    }
-    
-    kbuf = kmalloc(DRV_READBUF_SZ, GFP_KERNEL);
-
-    printk(READ_CMD_INFO "Reading the file");
-    while(true) {
-        ssize_t read = kfile_read(mscope.workfile_fp, &offset, kbuf, DRV_READBUF_SZ - 1);
-        if (read < 0) {
-            printk(READ_CMD_ERR "Could not read from file. Error %li ", read);
-        } else if (read == 0) {
-            printk(READ_CMD_INFO "End of file.");
-        } else {
-            kbuf[DRV_READBUF_SZ - 1] = '\0';
-            str_replace(kbuf, '\n', ' ');
-            printk(READ_CMD_INFO "Content: %s", kbuf);
-            continue;
-        }
-        break;
+    struct chdev_session *sess = fp->private_data;
+
+    if (workfile_readable(wf, pos))
+        return DRV_SUCCESS;
+    if (fp->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+
+    return wait_event_interruptible(wb_written_wq,
+                                    workfile_readable(wf, pos)
+                                    || READ_ONCE(sess->workfile_fp) != wf);
+}
+
+
+/*
+ * Returns the content of the work file. The device offset is the offset
+ * in the work file, so read(), pread() and lseek() behave as on the file
+ * itself. The work file fills the caller's iovecs directly, without a
+ * bounce buffer. At the end of the file the read blocks until new
+ * results are written, unless the device is opened with O_NONBLOCK.
+ */
+static ssize_t chdev_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct chdev_session *sess = iocb->ki_filp->private_data;
+    struct file *wf = session_get_workfile(sess);
+    ssize_t ret = 0;
+
+    if (!wf) {
+        printk(READ_CMD_ERR "Could not read from file. File is not open\n");
+        return -EBADF;
     }
 
-    kfree(kbuf);
-    return 0;
+    if (iov_iter_count(to))
+        ret = wait_for_results(iocb->ki_filp, wf, iocb->ki_pos);
+    if (!ret)
+        ret = vfs_iter_read(wf, to, &iocb->ki_pos);
+    if (ret < 0 && ret != -EAGAIN && ret != -ERESTARTSYS)
+        printk(READ_CMD_ERR "Could not read from file. Error %li\n", ret);
+
+    fput(wf);
+    return ret;
 }
 
 
-static bool is_digit(char c)
+/*
+ * Readable when the work file has data past the descriptor's offset, or
+ * when the ring holds results past the acknowledged index.
+ */
+static unsigned int chdev_poll(struct file *fp, poll_table *wait)
 {
-    return c >= 0x30 && c <= 0x39;
+    struct chdev_session *sess = fp->private_data;
+    struct chdev_ring *ring = NULL;
+    unsigned int mask = POLLOUT | POLLWRNORM;
+    struct file *wf = NULL;
+
+    poll_wait(fp, &wb_written_wq, wait);
+    poll_wait(fp, &sess->ring_wq, wait);
+    // Pairs with smp_mb() in cmd_commit()
+    smp_mb();
+
+    ring = READ_ONCE(sess->ring);
+    if (ring && smp_load_acquire(&ring->hdr->head) != READ_ONCE(sess->ring_consumed))
+        mask |= POLLIN | POLLRDNORM;
+
+    wf = session_get_workfile(sess);
+    if (wf) {
+        if (workfile_readable(wf, fp->f_pos))
+            mask |= POLLIN | POLLRDNORM;
+        fput(wf);
+    }
+    return mask;
 }
 
 
-static size_t digits_count(unsigned long long num)
+/* sendfile() and splice() take the pages straight from the work file */
+static ssize_t chdev_splice_read(struct file *fp,
+                                 loff_t *ppos,
+                                 struct pipe_inode_info *pipe,
+                                 size_t len,
+                                 unsigned int flags)
 {
-    size_t cnt = 0;
-    while (num) {
-        cnt++;
-        num /= 10;
-    } 
-    return cnt;
+    struct chdev_session *sess = fp->private_data;
+    struct file *wf = session_get_workfile(sess);
+    ssize_t ret = -EINVAL;
+
+    if (!wf) {
+        printk(READ_CMD_ERR "Could not splice from file. File is not open\n");
+        return -EBADF;
+    }
+
+    if (wf->f_op->splice_read)
+        ret = wf->f_op->splice_read(wf, ppos, pipe, len, flags);
+
+    fput(wf);
+    return ret;
 }
 
 
-static unsigned long long parse_num(char *num, size_t dig_cnt)
+static bool str_is_empty(char const* str)
 {
-    char tmp = num[dig_cnt];
-    unsigned long long res = 0;
+    return str[0] == '\0';
+}
 
-    num[dig_cnt] = '\0';
-    printk(WRITE_CMD_DBG "Find a number with %lu digits: %s", dig_cnt, num);
-    kstrtoull(num, 10, &res);
-    num[dig_cnt] = tmp;
 
-    return res;
+static bool str_starts_with(char const* str, char const* prefix, size_t prefix_len)
+{
+    return strncmp(str, prefix, prefix_len) == 0;
 }
 
 
-static unsigned long long sum_all_numbers(char *str)
+static bool cmd_open(struct chdev_session *sess, char const* fname)
 {
-    size_t digits_cnt = 0;
-    unsigned long long sum = 0;
-
-    do {
-        if (is_digit(*str)) {
-            digits_cnt++;
-        } else if (digits_cnt) {
-            char* num_start = str - digits_cnt;
-            sum += parse_num(num_start, digits_cnt);
-            digits_cnt = 0;
-        }
-    } while (*str++);
+    struct file *wf = NULL;
+
+    if (sess->workfile_fp) {
+        printk(OPEN_CMD_ERR "some file is already opened\n");
+        return false;
+    }
+    if (!(wf = kfile_open(fname, DRV_WORKFILE_PERM)))
+        return false;
 
-    printk(WRITE_CMD_DBG "sum of all numbers: %llu", sum);
-    return sum;
+    if (wb_init(&sess->wb, wf, wb_flush_bytes, wb_delay_ms)) {
+        printk(OPEN_CMD_ERR "could not allocate staging buffers\n");
+        kfile_close(wf);
+        return false;
+    }
+    sess->workfile_fp = wf;
+    return true;
 }
 
 
-static bool str_is_empty(char const* str)
+/*
+ * Text form of a result for the work file: the bare sum when only the sum
+ * is selected, "name=value" pairs otherwise.
+ */
+static int format_result(char *buf, size_t size, const struct chdev_result *res, unsigned int aggr)
 {
-    return str[0] == '\0';
+    int len = 0;
+
+    if (aggr == CHDEV_AGGR_SUM) {
+        len = u128_to_str(buf, size, res->sum_hi, res->sum_lo);
+        return len + scnprintf(buf + len, size - len, "\n");
+    }
+
+    if (aggr & CHDEV_AGGR_SUM) {
+        len += scnprintf(buf + len, size - len, "sum=");
+        len += u128_to_str(buf + len, size - len, res->sum_hi, res->sum_lo);
+    }
+    if (aggr & CHDEV_AGGR_COUNT)
+        len += scnprintf(buf + len, size - len, "%scount=%llu", len ? " " : "", res->count);
+    if (aggr & CHDEV_AGGR_MIN)
+        len += scnprintf(buf + len, size - len, "%smin=%llu", len ? " " : "", res->min);
+    if (aggr & CHDEV_AGGR_MAX)
+        len += scnprintf(buf + len, size - len, "%smax=%llu", len ? " " : "", res->max);
+    if (res->flags & CHDEV_RES_F_OVERFLOW)
+        len += scnprintf(buf + len, size - len, " skipped=%llu", res->skipped);
+
+    return len + scnprintf(buf + len, size - len, "\n");
 }
 
 
-static bool cmd_open(char const* fname)
+static bool cmd_commit(struct chdev_session *sess)
 {
-    if (mscope.workfile_fp) {
-        printk(OPEN_CMD_ERR "some file is already opened\n");
+    unsigned long long consumed = sess->parser.consumed;
+    struct chdev_result *res = &sess->last_result;
+    char line[DRV_RESULT_LINE_MAX];
+    int line_len = 0;
+    int err = 0;
+
+    if (!session_has_output(sess)) {
+        printk(COMMIT_CMD_ERR "neither file is opened nor ring is mapped");
         return false;
     }
-    mscope.workfile_fp = kfile_open(fname, DRV_WORKFILE_PERM);
-    return mscope.workfile_fp != NULL;
+
+    parser_commit(&sess->parser, res);
+    printk(COMMIT_CMD_DBG "count: %llu; skipped: %llu\n", res->count, res->skipped);
+
+    if (sess->ring) {
+        ring_publish(sess->ring, res);
+        // Orders the publish before the check, pairs with chdev_poll()
+        smp_mb();
+        if (waitqueue_active(&sess->ring_wq))
+            wake_up_interruptible_poll(&sess->ring_wq, POLLIN | POLLRDNORM);
+    }
+    if (!sess->workfile_fp)
+        return true;
+
+    line_len = format_result(line, sizeof(line), res, sess->aggr);
+    err = wb_append(&sess->wb, line, line_len);
+
+    printk(COMMIT_CMD_DBG "consumed: %llu; staged: %i; err: %i\n", consumed, line_len, err);
+    return !err;
 }
 
 
-static bool cmd_close(void) 
+static bool cmd_aggr(struct chdev_session *sess, unsigned int aggr)
 {
-    if (!mscope.workfile_fp) {
-        printk(CLOSE_CMD_ERR "file is not open");
+    if (!aggr || (aggr & ~CHDEV_AGGR_ALL)) {
+        printk(AGGR_CMD_ERR "invalid aggregate mask %#x\n", aggr);
         return false;
     }
-    kfile_close(mscope.workfile_fp);
-    mscope.workfile_fp = NULL;
+    sess->aggr = aggr;
     return true;
 }
 
 
-static char *create_io_buffer_for_num(unsigned long long num, size_t digits_cnt)
+/* Results below index are consumed, poll() stops reporting them */
+static bool cmd_ring_ack(struct chdev_session *sess, __u64 index)
 {
-    char *io_buf = kmalloc(digits_cnt + 1, GFP_KERNEL);
+    if (!sess->ring) {
+        printk(RING_ACK_CMD_ERR "failed. Ring is not mapped\n");
+        return false;
+    }
+    if (index > sess->ring->hdr->head) {
+        printk(RING_ACK_CMD_ERR "index %llu is past the ring head\n", index);
+        return false;
+    }
+    WRITE_ONCE(sess->ring_consumed, index);
+    return true;
+}
 
-    printk(WRITE_CMD_DBG "Creating io buffer for number with %lu digits\n", digits_cnt);
-    sprintf(io_buf, "%llu", num);
-    io_buf[digits_cnt] = '\n';
 
-    return io_buf;
+/* Parses a comma separated list like "sum,count,min,max" */
+static unsigned int parse_aggr_list(char *list)
+{
+    static const struct {
+        const char *name;
+        unsigned int aggr;
+    } names[] = {
+        { "sum", CHDEV_AGGR_SUM },
+        { "count", CHDEV_AGGR_COUNT },
+        { "min", CHDEV_AGGR_MIN },
+        { "max", CHDEV_AGGR_MAX },
+    };
+    unsigned int aggr = 0;
+    char *name = NULL;
+
+    while ((name = strsep(&list, ",")) != NULL) {
+        size_t i = 0;
+
+        for (i = 0; i < ARRAY_SIZE(names); i++)
+            if (strcmp(name, names[i].name) == 0)
+                break;
+        if (i == ARRAY_SIZE(names))
+            return 0;
+        aggr |= names[i].aggr;
+    }
+    return aggr;
 }
 
 
-static bool cmd_write(char *buf, size_t sz, loff_t *off)
+static bool cmd_sync(struct chdev_session *sess)
 {
-    ssize_t wrote = 0;
-    size_t dig_cnt = 0;
-    unsigned long long sum = 0;
-    char *sum_buf = NULL;
+    int err = 0;
 
-    if (!mscope.workfile_fp) {
-        printk(WRITE_CMD_ERR "file is not opened");
+    if (!sess->workfile_fp) {
+        printk(SYNC_CMD_ERR "file is not open");
         return false;
     }
+    if ((err = wb_sync(&sess->wb)))
+        printk(SYNC_CMD_ERR "write back failed. Error %i\n", err);
+    return !err;
+}
 
-    sum = sum_all_numbers(buf);
-    dig_cnt = digits_count(sum);
-    sum_buf = create_io_buffer_for_num(sum, dig_cnt);
 
-    wrote = kfile_write(mscope.workfile_fp, 
-                        &mscope.workfile_fp->f_pos, 
-                        sum_buf, 
-                        dig_cnt + 1);
+static bool cmd_close(struct chdev_session *sess) 
+{
+    if (!sess->workfile_fp) {
+        printk(CLOSE_CMD_ERR "file is not open");
+        return false;
+    }
+    if (parser_pending(&sess->parser) && !cmd_commit(sess))
+        printk(CLOSE_CMD_ERR "pending numbers are lost\n");
+
+    wb_deinit(&sess->wb);
+    kfile_close(sess->workfile_fp);
+    sess->workfile_fp = NULL;
 
-    printk(WRITE_CMD_DBG "size: %lu; wrote: %li\n", sz, wrote);
-    kfree(sum_buf);
-    return sz;
+    // Readers blocked on this file see the end of it
+    wake_up_interruptible(&wb_written_wq);
+    return true;
 }
 
 
-static ssize_t chdev_write(struct file *fp, 
-                           const char __user *buf, 
-                           size_t len, 
-                           loff_t *off)
+static bool cmd_write(struct chdev_session *sess, char const *buf, size_t sz)
 {
-    char *str = NULL;
+    if (!session_has_output(sess)) {
+        printk(WRITE_CMD_ERR "neither file is opened nor ring is mapped");
+        return false;
+    }
+
+    parser_feed(&sess->parser, buf, sz);
+    printk(WRITE_CMD_DBG "size: %lu; pending: %llu\n", sz, sess->parser.consumed);
+    return true;
+}
 
-    printk(DRV_LOG_WR_DBG "buffer size %lu\n", len);
-    printk(DRV_LOG_WR_DBG "offset %lli\n", *off);
-    printk(DRV_LOG_WR_DBG "moving incoming buf to kernel space\n");
 
-    str = kmalloc(len, GFP_KERNEL);
-    copy_from_user(str, buf, len);
-    str[len - 1] = '\0';
+/*
+ * Commands are only recognized when a write() consists of the command
+ * alone (with an optional trailing newline). Everything else, a lone
+ * newline included, is a chunk of the number stream and is left as it
+ * was written.
+ */
+static bool try_exec_cmd(struct chdev_session *sess, char *str, size_t len)
+{
+    bool stripped = len && str[len - 1] == '\n';
 
-    printk(DRV_LOG_WR_DBG "Buffer successfully moved. Content %s\n", str);
+    if (stripped)
+        str[len - 1] = '\0';
 
-    if (str_is_empty(str)) {
+    if (!len) {
         printk(DRV_LOG_WR_INFO "No operations\n");
 
-    } else if (str_contains(str, DRV_CMD_OPEN)) {
+    } else if (str_starts_with(str, DRV_CMD_OPEN, DRV_CMD_OPEN_STRLEN)) {
         char const *fname = str + DRV_CMD_OPEN_STRLEN;
         printk(OPEN_CMD_INFO "Performing open() command\n");
         if (str_is_empty(fname))
             printk(OPEN_CMD_ERR "failed. Filename is empty.\n");
-        else if (!cmd_open(fname))
+        else if (!cmd_open(sess, fname))
             printk(OPEN_CMD_ERR "failed. Could not open the file \"%s\".\n", fname);
         else
             printk(OPEN_CMD_INFO "operation successfully performed\n");
 
     } else if (strcmp(str, DRV_CMD_CLOSE) == 0) {
         printk(CLOSE_CMD_INFO "Performing close() command\n");
-        if (!cmd_close())
+        if (!cmd_close(sess))
             printk(CLOSE_CMD_ERR "failed. Could not close the file\n");
         else 
             printk(CLOSE_CMD_INFO "operation successfully performed\n");
 
-    } else {
-        printk(WRITE_CMD_INFO "Perfrorming write() command\n");
-        if (!cmd_write(str, len, off))
-            printk(WRITE_CMD_ERR "failed. Could not write to file\n");
+    } else if (strcmp(str, DRV_CMD_COMMIT) == 0) {
+        printk(COMMIT_CMD_INFO "Performing commit() command\n");
+        if (!cmd_commit(sess))
+            printk(COMMIT_CMD_ERR "failed. Could not write the sum to file\n");
+        else
+            printk(COMMIT_CMD_INFO "operation successfully performed\n");
+
+    } else if (str_starts_with(str, DRV_CMD_AGGR, DRV_CMD_AGGR_STRLEN)) {
+        printk(AGGR_CMD_INFO "Performing aggr() command\n");
+        if (!cmd_aggr(sess, parse_aggr_list(str + DRV_CMD_AGGR_STRLEN)))
+            printk(AGGR_CMD_ERR "failed. Expected a list of sum,count,min,max\n");
+        else
+            printk(AGGR_CMD_INFO "operation successfully performed\n");
+
+    } else if (strcmp(str, DRV_CMD_SYNC) == 0) {
+        printk(SYNC_CMD_INFO "Performing sync() command\n");
+        if (!cmd_sync(sess))
+            printk(SYNC_CMD_ERR "failed. Could not sync the file\n");
         else
-            printk(WRITE_CMD_INFO "operation successfully performed\n");
+            printk(SYNC_CMD_INFO "operation successfully performed\n");
+
+    } else {
+        if (stripped)
+            str[len - 1] = '\n';
+        return false;
     }
+    return true;
+}
 
-    kfree(str);
-    return len;
+
+/*
+ * Feeds user memory into the number stream. All the segments of the
+ * iterator make up one stream, they are copied through the session's
+ * chunk buffer and never linearized. The session lock is held.
+ */
+static ssize_t feed_from_iter(struct chdev_session *sess, struct iov_iter *from)
+{
+    size_t done = 0;
+    ssize_t err = 0;
+
+    while (iov_iter_count(from)) {
+        size_t n = copy_from_iter(sess->chunk, DRV_WRITE_CHUNK_SZ, from);
+
+        if (!n) {
+            printk(DRV_LOG_WR_ERR "failed to copy data from user\n");
+            err = -EFAULT;
+            break;
+        }
+        if (!cmd_write(sess, sess->chunk, n)) {
+            printk(WRITE_CMD_ERR "failed. Could not consume the data\n");
+            err = -EBADF;
+            break;
+        }
+        done += n;
+    }
+
+    return done ? done : err;
+}
+
+
+static ssize_t chdev_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct chdev_session *sess = iocb->ki_filp->private_data;
+    size_t len = iov_iter_count(from);
+    ssize_t ret = len;
+    char *str = sess->chunk;
+
+    printk(DRV_LOG_WR_DBG "buffer size %lu\n", len);
+
+    mutex_lock(&sess->lock);
+    if (len > DRV_CMD_MAX_LEN) {
+        ret = feed_from_iter(sess, from);
+
+    } else if (copy_from_iter(str, len, from) != len) {
+        ret = -EFAULT;
+
+    } else {
+        // Short writes may be commands, the chunk has room for the NUL
+        str[len] = '\0';
+        if (!try_exec_cmd(sess, str, len) && !cmd_write(sess, str, len)) {
+            printk(WRITE_CMD_ERR "failed. Could not consume the data\n");
+            ret = -EBADF;
+        }
+    }
+    mutex_unlock(&sess->lock);
+
+    return ret;
+}
+
+
+static int copy_result_to_user(struct chdev_session *sess, struct chdev_op *op)
+{
+    void __user *uaddr = (void __user *)(uintptr_t)op->addr;
+    size_t sz = min_t(size_t, op->len, sizeof(sess->last_result));
+
+    if (!uaddr)
+        return DRV_SUCCESS;
+    return copy_to_user(uaddr, &sess->last_result, sz) ? -EFAULT : DRV_SUCCESS;
+}
+
+
+static int exec_op(struct chdev_session *sess, struct chdev_op *op)
+{
+    void __user *uaddr = (void __user *)(uintptr_t)op->addr;
+    struct iov_iter iter;
+    struct iovec iov;
+    ssize_t fed = 0;
+    char *fname = NULL;
+    bool ok = false;
+
+    switch (op->code) {
+        case CHDEV_OP_OPEN:
+            fname = strndup_user(uaddr, PATH_MAX);
+            if (IS_ERR(fname))
+                return PTR_ERR(fname);
+            ok = cmd_open(sess, fname);
+            kfree(fname);
+            return ok ? DRV_SUCCESS : -EIO;
+
+        case CHDEV_OP_CLOSE:
+            return cmd_close(sess) ? DRV_SUCCESS : -EBADF;
+
+        case CHDEV_OP_FEED:
+        case CHDEV_OP_SUM:
+            fed = import_single_range(WRITE, uaddr, op->len, &iov, &iter);
+            if (fed < 0)
+                return fed;
+            fed = feed_from_iter(sess, &iter);
+            if (fed < 0)
+                return fed;
+            if (fed != op->len)
+                return -EFAULT;
+            if (op->code == CHDEV_OP_FEED)
+                return DRV_SUCCESS;
+            // fall through: SUM commits what was fed
+
+        case CHDEV_OP_COMMIT:
+            if (!cmd_commit(sess))
+                return -EIO;
+            op->result = sess->last_result.sum_lo;
+            if (op->code == CHDEV_OP_SUM)
+                return DRV_SUCCESS;
+            return copy_result_to_user(sess, op);
+
+        case CHDEV_OP_QUERY:
+            op->result = sess->last_result.sum_lo;
+            return copy_result_to_user(sess, op);
+
+        case CHDEV_OP_SYNC:
+            return cmd_sync(sess) ? DRV_SUCCESS : -EIO;
+
+        case CHDEV_OP_AGGR:
+            return cmd_aggr(sess, op->len) ? DRV_SUCCESS : -EINVAL;
+
+        case CHDEV_OP_RING_ACK:
+            return cmd_ring_ack(sess, op->len) ? DRV_SUCCESS : -EINVAL;
+    }
+    return -EINVAL;
+}
+
+
+/*
+ * Runs a batch of fixed-size operation descriptors under one kernel entry.
+ * Execution stops at the first failing operation; batch.done tells how
+ * many were executed, each one reports its own status.
+ */
+static long chdev_ioctl(struct file *fp, unsigned int cmd, unsigned long arg)
+{
+    struct chdev_session *sess = fp->private_data;
+    struct chdev_batch __user *ubatch = (void __user *)arg;
+    struct chdev_op __user *uops = NULL;
+    struct chdev_op ops[DRV_BATCH_CHUNK];
+    struct chdev_batch batch;
+    long err = 0;
+
+    if (cmd != CHDEV_IOC_BATCH)
+        return -ENOTTY;
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+
+    uops = (struct chdev_op __user *)(uintptr_t)batch.ops;
+    batch.done = 0;
+
+    mutex_lock(&sess->lock);
+    while (batch.done < batch.count && !err) {
+        size_t n = min_t(size_t, batch.count - batch.done, DRV_BATCH_CHUNK);
+        size_t i = 0;
+
+        if (copy_from_user(ops, uops + batch.done, n * sizeof(ops[0]))) {
+            err = -EFAULT;
+            break;
+        }
+        for (i = 0; i < n && !err; i++)
+            err = ops[i].status = exec_op(sess, &ops[i]);
+
+        if (copy_to_user(uops + batch.done, ops, i * sizeof(ops[0])))
+            err = -EFAULT;
+        batch.done += i;
+    }
+    mutex_unlock(&sess->lock);
+
+    if (put_user(batch.done, &ubatch->done))
+        return -EFAULT;
+    return err;
+}
+
+
+static int chdev_open(struct inode *ip, struct file *fp)
+{
+    struct chdev_session *sess = session_create();
+
+    if (!sess) {
+        printk(DRV_LOG_ERR "Failed to allocate session\n");
+        return -ENOMEM;
+    }
+    fp->private_data = sess;
+    return DRV_SUCCESS;
+}
+
+
+static int chdev_release(struct inode *ip, struct file *fp)
+{
+    struct chdev_session *sess = fp->private_data;
+
+    if (session_has_output(sess) && parser_pending(&sess->parser))
+        cmd_commit(sess);
+
+    session_destroy(sess);
+    fp->private_data = NULL;
+    return DRV_SUCCESS;
+}
+
+
+/*
+ * mmap_sem is held here while writers fault under the session lock, so
+ * the ring is installed with cmpxchg() instead of under the lock. The
+ * loser of a race frees its ring.
+ */
+static struct chdev_ring *session_get_ring(struct chdev_session *sess)
+{
+    struct chdev_ring *ring = READ_ONCE(sess->ring);
+    struct chdev_ring *old = NULL;
+
+    if (ring)
+        return ring;
+
+    ring = ring_create(ring_slots);
+    if (!ring)
+        return NULL;
+
+    old = cmpxchg(&sess->ring, NULL, ring);
+    if (old) {
+        ring_destroy(ring);
+        return old;
+    }
+    return ring;
+}
+
+
+static int chdev_mmap(struct file *fp, struct vm_area_struct *vma)
+{
+    struct chdev_ring *ring = session_get_ring(fp->private_data);
+    int err = ring ? ring_mmap(ring, vma) : -ENOMEM;
+
+    if (err)
+        printk(DRV_LOG_ERR "Failed to map result ring. Error code: %i\n", err);
+    return err;
 }
 
 
@@ -264,8 +681,14 @@ static const struct file_operations chdev_ops = {
     .owner = THIS_MODULE,
     .open = chdev_open,
     .release = chdev_release,
-    .read = chdev_read,
-    .write = chdev_write
+    .llseek = default_llseek,
+    .read_iter = chdev_read_iter,
+    .splice_read = chdev_splice_read,
+    .write_iter = chdev_write_iter,
+    .poll = chdev_poll,
+    .unlocked_ioctl = chdev_ioctl,
+    .compat_ioctl = chdev_ioctl,
+    .mmap = chdev_mmap
 };
 
 
@@ -273,13 +696,25 @@ static int __init chdev_init(void)
 {
     int err = DRV_FAILURE;
 
+    if (!ring_slots) {
+        printk(DRV_LOG_ERR "ring_slots must not be zero\n");
+        return -EINVAL;
+    }
     if (( err = alloc_chrdev_region(&mscope.dev, 0, 1, "lab1_chdrv") )) {
         printk(DRV_LOG_ERR "Failed to alloc region. Error code: %i", err);
         return err;
     } 
+    if (( err = session_module_init() )) {
+        printk(DRV_LOG_ERR "Failed to create session caches. Error code: %i\n", err);
+        goto err_undo_reg;
+    }
+    if (( err = wb_module_init() )) {
+        printk(DRV_LOG_ERR "Failed to create writeback workqueue. Error code: %i\n", err);
+        goto err_undo_session_init;
+    }
     if ((mscope.cl = class_create(THIS_MODULE, "ch_driver")) == NULL) {
         printk(DRV_LOG_ERR "Failed to create class. Error code: %i\n", err);
-        goto err_undo_reg;
+        goto err_undo_wb_init;
     }
     if (device_create(mscope.cl, NULL, mscope.dev, NULL, "chdev") == NULL) {
         printk(DRV_LOG_ERR "Failed to create device. Error code: %i\n", err);
@@ -302,6 +737,12 @@ err_undo_dev_create:
 err_undo_cl_create: 
     class_destroy(mscope.cl);
     printk(DRV_LOG_DBG "Class destoryed\n");
+err_undo_wb_init: 
+    wb_module_exit();
+    printk(DRV_LOG_DBG "Writeback workqueue destroyed\n");
+err_undo_session_init: 
+    session_module_exit();
+    printk(DRV_LOG_DBG "Session caches destroyed\n");
 err_undo_reg: 
     unregister_chrdev_region(mscope.dev, 1);
     printk(DRV_LOG_DBG "Region unregistered\n");
@@ -315,6 +756,8 @@ static void __exit chdev_exit(void)
     cdev_del(&mscope.cdev);
     device_destroy(mscope.cl, mscope.dev);
     class_destroy(mscope.cl);
+    wb_module_exit();
+    session_module_exit();
     unregister_chrdev_region(mscope.dev, 1);
 
     printk(DRV_LOG_INFO "Module has removed\n");
@@ -0,0 +1,173 @@
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+
+#include "parser.h"
+
+
+/*
+ * The input is scanned a machine word (8 chars) at a time. Bytes are
+ * classified with SWAR arithmetic and digit runs are converted into
+ * numbers with three multiplications, without touching them one by one.
+ * The first char of the stream always ends up in the lowest byte.
+ */
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define SWAR_WORD_SZ sizeof(u64)
+
+static const unsigned long long pow10[SWAR_WORD_SZ + 1] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL,
+    100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+};
+
+
+static bool is_digit(char c)
+{
+    return c >= 0x30 && c <= 0x39;
+}
+
+
+static void parser_end_number(struct num_parser *p)
+{
+    struct chdev_result *res = &p->res;
+
+    if (p->overflow) {
+        // Does not fit into u64: left out of the aggregates, but reported
+        res->skipped++;
+    } else {
+        res->count++;
+        res->sum_lo += p->cur;
+        res->sum_hi += res->sum_lo < p->cur;
+        if (p->cur < res->min)
+            res->min = p->cur;
+        if (p->cur > res->max)
+            res->max = p->cur;
+    }
+
+    p->cur = 0;
+    p->digits = 0;
+    p->overflow = false;
+}
+
+
+/* Bit 7 of every byte of the result is set iff that byte is a digit */
+static inline u64 swar_digit_mask(u64 w)
+{
+    u64 low7 = w & (SWAR_ONES * 0x7F);
+    u64 above_nine = low7 + SWAR_ONES * (0x80 - 0x3A);
+    u64 from_zero = low7 + SWAR_ONES * (0x80 - 0x30);
+
+    return from_zero & ~above_nine & ~w & SWAR_HIGHS;
+}
+
+
+/* Value of up to 8 digits; leading positions have to hold zero bytes */
+static inline u64 swar_to_num(u64 w)
+{
+    w = ((w & (SWAR_ONES * 0x0F)) * ((10 << 8) + 1)) >> 8;
+    w = ((w & 0x00FF00FF00FF00FFULL) * ((100 << 16) + 1)) >> 16;
+    w = ((w & 0x0000FFFF0000FFFFULL) * ((10000ULL << 32) + 1)) >> 32;
+    return w;
+}
+
+
+static void parser_append(struct num_parser *p, u64 val, unsigned int ndig)
+{
+    if (p->cur > (ULLONG_MAX - val) / pow10[ndig])
+        p->overflow = true;
+    p->cur = p->cur * pow10[ndig] + val;
+    p->digits += ndig;
+}
+
+
+static void parser_feed_word(struct num_parser *p, u64 w)
+{
+    u64 dmask = swar_digit_mask(w);
+    u64 omask = ~dmask & SWAR_HIGHS;
+    unsigned int pos = 0;
+
+    if (!omask) {
+        parser_append(p, swar_to_num(w), SWAR_WORD_SZ);
+        return;
+    }
+    if (!dmask) {
+        if (p->digits)
+            parser_end_number(p);
+        return;
+    }
+
+    while (pos < SWAR_WORD_SZ) {
+        u64 digits = dmask >> (8 * pos);
+        u64 others = omask >> (8 * pos);
+        unsigned int run = 0;
+
+        if (digits & 0x80) {
+            run = others ? __ffs64(others) / 8 : SWAR_WORD_SZ - pos;
+            // Move the run to the top, zero bytes below act as leading zeros
+            parser_append(p,
+                          swar_to_num((w >> (8 * pos)) << (8 * (SWAR_WORD_SZ - run))),
+                          run);
+        } else {
+            run = digits ? __ffs64(digits) / 8 : SWAR_WORD_SZ - pos;
+            if (p->digits)
+                parser_end_number(p);
+        }
+        pos += run;
+    }
+}
+
+
+void parser_reset(struct num_parser *p)
+{
+    p->cur = 0;
+    p->digits = 0;
+    p->overflow = false;
+    memset(&p->res, 0, sizeof(p->res));
+    p->res.min = ULLONG_MAX;
+    p->consumed = 0;
+}
+
+
+void parser_feed(struct num_parser *p, const char *buf, size_t len)
+{
+    const char *end = buf + len;
+
+    p->consumed += len;
+    for (; end - buf >= SWAR_WORD_SZ; buf += SWAR_WORD_SZ)
+        parser_feed_word(p, get_unaligned_le64(buf));
+
+    for (; buf < end; buf++) {
+        if (is_digit(*buf)) {
+            unsigned int dig = *buf - '0';
+
+            if (p->cur > (ULLONG_MAX - dig) / 10)
+                p->overflow = true;
+            p->cur = p->cur * 10 + dig;
+            p->digits++;
+        } else if (p->digits) {
+            parser_end_number(p);
+        }
+    }
+}
+
+
+void parser_commit(struct num_parser *p, struct chdev_result *res)
+{
+    if (p->digits)
+        parser_end_number(p);
+
+    *res = p->res;
+    if (!res->count)
+        res->min = 0;
+    if (res->skipped)
+        res->flags |= CHDEV_RES_F_OVERFLOW;
+
+    parser_reset(p);
+}
+
+
+bool parser_pending(const struct num_parser *p)
+{
+    return p->consumed != 0;
+}
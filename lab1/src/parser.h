@@ -0,0 +1,29 @@
+#ifndef CDEV_PARSER_H
+#define CDEV_PARSER_H
+
+#include <linux/types.h>
+
+#include "uapi.h"
+
+
+/*
+ * Incremental decimal number scanner. Input may be split at any byte,
+ * a number cut in half by two write() calls is still counted as one.
+ * Memory use does not depend on the input size. All the aggregates of
+ * struct chdev_result are maintained in the same pass.
+ */
+struct num_parser {
+    unsigned long long cur;     /* value of the number being scanned */
+    size_t digits;              /* digits of it seen so far, 0 between numbers */
+    bool overflow;              /* current number does not fit into u64 */
+    struct chdev_result res;    /* aggregates of the numbers terminated so far */
+    unsigned long long consumed;/* bytes fed since the last commit */
+};
+
+
+void parser_reset(struct num_parser *p);
+void parser_feed(struct num_parser *p, const char *buf, size_t len);
+void parser_commit(struct num_parser *p, struct chdev_result *res);
+bool parser_pending(const struct num_parser *p);
+
+#endif
@@ -0,0 +1,66 @@
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "ring.h"
+
+
+struct chdev_ring *ring_create(unsigned int nslots)
+{
+    struct chdev_ring *ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+
+    // roundup_pow_of_two(0) is undefined
+    if (!ring || !nslots) {
+        kfree(ring);
+        return NULL;
+    }
+
+    nslots = roundup_pow_of_two(nslots);
+    ring->size = PAGE_ALIGN(CHDEV_RING_SLOTS_OFFSET + nslots * sizeof(struct chdev_result));
+    ring->mask = nslots - 1;
+
+    // Zeroed and suitable for remap_vmalloc_range()
+    ring->hdr = vmalloc_user(ring->size);
+    if (!ring->hdr) {
+        kfree(ring);
+        return NULL;
+    }
+    ring->slots = (struct chdev_result *)((char *)ring->hdr + CHDEV_RING_SLOTS_OFFSET);
+    ring->hdr->magic = CHDEV_RING_MAGIC;
+    ring->hdr->nslots = nslots;
+    return ring;
+}
+
+
+void ring_destroy(struct chdev_ring *ring)
+{
+    vfree(ring->hdr);
+    kfree(ring);
+}
+
+
+/* Callers serialize publishing, consumers only read */
+void ring_publish(struct chdev_ring *ring, const struct chdev_result *result)
+{
+    __u64 head = ring->hdr->head;
+
+    if (head - ring->hdr->tail > ring->mask) {
+        // Full: retire the oldest slot before overwriting it
+        WRITE_ONCE(ring->hdr->tail, ring->hdr->tail + 1);
+        smp_wmb();
+    }
+    ring->slots[head & ring->mask] = *result;
+    smp_store_release(&ring->hdr->head, head + 1);
+}
+
+
+int ring_mmap(struct chdev_ring *ring, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > ring->size)
+        return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+    vma->vm_flags &= ~VM_MAYWRITE;
+    return remap_vmalloc_range(vma, (void *)ring->hdr, 0);
+}
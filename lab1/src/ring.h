@@ -0,0 +1,24 @@
+#ifndef CDEV_RING_H
+#define CDEV_RING_H
+
+#include <linux/mm.h>
+#include <linux/types.h>
+
+#include "uapi.h"
+
+
+/* Single producer ring of results that userspace maps read-only */
+struct chdev_ring {
+    struct chdev_ring_header *hdr;
+    struct chdev_result *slots;
+    unsigned int mask;
+    size_t size;
+};
+
+
+struct chdev_ring *ring_create(unsigned int nslots);
+void ring_destroy(struct chdev_ring *ring);
+void ring_publish(struct chdev_ring *ring, const struct chdev_result *result);
+int ring_mmap(struct chdev_ring *ring, struct vm_area_struct *vma);
+
+#endif
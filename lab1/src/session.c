@@ -0,0 +1,98 @@
+#include "session.h"
+#include "commands.h"
+#include "constants.h"
+
+
+/*
+ * Sessions and their input chunks come from dedicated caches and are
+ * allocated once per open(), so reads and writes never allocate.
+ */
+static struct kmem_cache *session_cache;
+static struct kmem_cache *chunk_cache;
+
+
+int session_module_init(void)
+{
+    // Short writes are copied whole and NUL-terminated to parse commands
+    BUILD_BUG_ON(DRV_CMD_MAX_LEN + 1 > DRV_WRITE_CHUNK_SZ);
+
+    session_cache = KMEM_CACHE(chdev_session, 0);
+    if (!session_cache)
+        return -ENOMEM;
+
+    chunk_cache = kmem_cache_create("chdev_chunk", DRV_WRITE_CHUNK_SZ, 0, 0, NULL);
+    if (!chunk_cache) {
+        kmem_cache_destroy(session_cache);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+
+void session_module_exit(void)
+{
+    kmem_cache_destroy(chunk_cache);
+    kmem_cache_destroy(session_cache);
+}
+
+
+struct chdev_session *session_create(void)
+{
+    struct chdev_session *sess = kmem_cache_zalloc(session_cache, GFP_KERNEL);
+
+    if (!sess)
+        return NULL;
+
+    sess->chunk = kmem_cache_alloc(chunk_cache, GFP_KERNEL);
+    if (!sess->chunk) {
+        kmem_cache_free(session_cache, sess);
+        return NULL;
+    }
+
+    mutex_init(&sess->lock);
+    sess->workfile_fp = NULL;
+    parser_reset(&sess->parser);
+    sess->aggr = CHDEV_AGGR_SUM;
+    sess->ring = NULL;
+    sess->ring_consumed = 0;
+    init_waitqueue_head(&sess->ring_wq);
+    return sess;
+}
+
+
+void session_destroy(struct chdev_session *sess)
+{
+    if (sess->workfile_fp) {
+        wb_deinit(&sess->wb);
+        kfile_close(sess->workfile_fp);
+    }
+    if (sess->ring)
+        ring_destroy(sess->ring);
+
+    mutex_destroy(&sess->lock);
+    kmem_cache_free(chunk_cache, sess->chunk);
+    kmem_cache_free(session_cache, sess);
+}
+
+
+bool session_has_output(const struct chdev_session *sess)
+{
+    return sess->workfile_fp || sess->ring;
+}
+
+
+/*
+ * Takes a reference to the work file, so it can be read without holding
+ * the session lock while another thread closes it. Release with fput().
+ */
+struct file *session_get_workfile(struct chdev_session *sess)
+{
+    struct file *wf = NULL;
+
+    mutex_lock(&sess->lock);
+    if (sess->workfile_fp)
+        wf = get_file(sess->workfile_fp);
+    mutex_unlock(&sess->lock);
+
+    return wf;
+}
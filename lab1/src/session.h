@@ -0,0 +1,42 @@
+#ifndef CDEV_SESSION_H
+#define CDEV_SESSION_H
+
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+#include "parser.h"
+#include "ring.h"
+#include "writeback.h"
+
+
+/*
+ * State of a single open() of the device. Lives in fp->private_data,
+ * so every client gets its own work file and output offset and clients
+ * never contend with each other. The mutex only serializes threads that
+ * share the same file descriptor.
+ */
+struct chdev_session {
+    struct mutex lock;
+    struct file *workfile_fp;
+    struct chdev_wb wb;         /* valid while workfile_fp is set */
+    struct num_parser parser;
+    struct chdev_result last_result;
+    unsigned int aggr;          /* CHDEV_AGGR_* put into the work file */
+    struct chdev_ring *ring;
+    __u64 ring_consumed;        /* acknowledged with CHDEV_OP_RING_ACK */
+    wait_queue_head_t ring_wq;  /* poll() waiting for ring results */
+    char *chunk;                /* DRV_WRITE_CHUNK_SZ bytes of copied input */
+};
+
+
+int session_module_init(void);
+void session_module_exit(void);
+
+struct chdev_session *session_create(void);
+void session_destroy(struct chdev_session *sess);
+bool session_has_output(const struct chdev_session *sess);
+struct file *session_get_workfile(struct chdev_session *sess);
+
+#endif
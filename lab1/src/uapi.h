@@ -0,0 +1,106 @@
+#ifndef CDEV_UAPI_H
+#define CDEV_UAPI_H
+
+/*
+ * Definitions shared between the driver and its userspace clients.
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+
+/*
+ * Aggregates of the numbers committed at once. They are all computed in
+ * a single pass; the session's aggregate mask only selects what goes
+ * into the text line of the work file.
+ */
+enum chdev_aggr {
+    CHDEV_AGGR_SUM = 1 << 0,
+    CHDEV_AGGR_COUNT = 1 << 1,
+    CHDEV_AGGR_MIN = 1 << 2,
+    CHDEV_AGGR_MAX = 1 << 3,
+};
+
+#define CHDEV_AGGR_ALL (CHDEV_AGGR_SUM | CHDEV_AGGR_COUNT | CHDEV_AGGR_MIN | CHDEV_AGGR_MAX)
+
+/* Some numbers did not fit into 64 bits and were skipped */
+#define CHDEV_RES_F_OVERFLOW (1 << 0)
+
+struct chdev_result {
+    __u64 sum_lo;       /* the sum is a 128-bit number and never wraps */
+    __u64 sum_hi;
+    __u64 count;
+    __u64 min;          /* 0 if count is 0 */
+    __u64 max;
+    __u64 skipped;      /* numbers beyond 64 bits */
+    __u32 flags;        /* CHDEV_RES_F_* */
+    __u32 reserved;
+};
+
+
+#define CHDEV_RING_MAGIC 0x63687267 /* "chrg" */
+
+/*
+ * The result ring is mapped read-only with mmap(fd, ..., offset 0).
+ * The first page holds the header, the result slots follow it.
+ *
+ * head is the number of results ever published and tail the index of
+ * the oldest one still kept. The result i lives in slots[i % nslots],
+ * every slot holds a struct chdev_result.
+ * A consumer remembers its own index, reads the slots below head and
+ * re-checks tail afterwards: if tail has moved past the index, the slot
+ * was overwritten while being read and the result is lost.
+ *
+ * poll() reports POLLIN while head is past the index last acknowledged
+ * with CHDEV_OP_RING_ACK, whether or not read() has data.
+ */
+struct chdev_ring_header {
+    __u32 magic;
+    __u32 nslots;
+    __u64 head;
+    __u64 tail;
+};
+
+#define CHDEV_RING_SLOTS_OFFSET 4096
+
+
+/*
+ * Batch interface: CHDEV_IOC_BATCH executes an array of operations in
+ * order within a single syscall and stops at the first failing one.
+ */
+enum chdev_op_code {
+    CHDEV_OP_OPEN = 1,  /* open the work file, addr: NUL-terminated path */
+    CHDEV_OP_CLOSE,     /* commit pending numbers and close the work file */
+    CHDEV_OP_FEED,      /* feed addr[0..len) into the number stream */
+    CHDEV_OP_COMMIT,    /* publish the aggregates of the stream */
+    CHDEV_OP_SUM,       /* FEED followed by COMMIT */
+    CHDEV_OP_QUERY,     /* the last committed aggregates */
+    CHDEV_OP_SYNC,      /* write staged results out and fsync the work file */
+    CHDEV_OP_AGGR,      /* select the text aggregates, len: CHDEV_AGGR_* mask */
+    CHDEV_OP_RING_ACK,  /* ring results below len are consumed */
+};
+
+/*
+ * COMMIT, SUM and QUERY put the low 64 bits of the sum into result.
+ * COMMIT and QUERY also copy the whole struct chdev_result to addr,
+ * unless addr is 0, len tells the size of that buffer.
+ */
+
+struct chdev_op {
+    __u32 code;
+    __s32 status;       /* out: 0 or -errno */
+    __u64 addr;
+    __u64 len;
+    __u64 result;       /* out */
+};
+
+struct chdev_batch {
+    __u64 ops;          /* pointer to struct chdev_op[count] */
+    __u32 count;
+    __u32 done;         /* out: operations executed */
+};
+
+#define CHDEV_IOC_MAGIC 'c'
+#define CHDEV_IOC_BATCH _IOWR(CHDEV_IOC_MAGIC, 1, struct chdev_batch)
+
+#endif
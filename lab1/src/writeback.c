@@ -0,0 +1,145 @@
+#include <linux/jiffies.h>
+#include <linux/slab.h>
+
+#include "commands.h"
+#include "writeback.h"
+
+
+#define WB_BUF_SZ PAGE_SIZE
+
+static struct workqueue_struct *wb_wq;
+
+DECLARE_WAIT_QUEUE_HEAD(wb_written_wq);
+
+
+int wb_module_init(void)
+{
+    wb_wq = alloc_workqueue("chdev_wb", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+    return wb_wq ? 0 : -ENOMEM;
+}
+
+
+void wb_module_exit(void)
+{
+    destroy_workqueue(wb_wq);
+}
+
+
+/* Writes out everything staged so far */
+static int wb_flush(struct chdev_wb *wb)
+{
+    ssize_t wrote = 0;
+    size_t len = 0;
+    char *out = NULL;
+    int err = 0;
+
+    mutex_lock(&wb->flush_lock);
+
+    spin_lock(&wb->lock);
+    out = wb->buf;
+    len = wb->len;
+    wb->buf = wb->spare;
+    wb->len = 0;
+    spin_unlock(&wb->lock);
+    wb->spare = out;
+
+    if (len) {
+        wrote = kfile_write(wb->fp, &wb->off, out, len);
+        if (wrote != len && !wb->err)
+            wb->err = wrote < 0 ? wrote : -EIO;
+        if (wrote > 0)
+            wake_up_interruptible_poll(&wb_written_wq, POLLIN | POLLRDNORM);
+    }
+    err = wb->err;
+
+    mutex_unlock(&wb->flush_lock);
+    return err;
+}
+
+
+static void wb_worker(struct work_struct *work)
+{
+    struct chdev_wb *wb = container_of(to_delayed_work(work), struct chdev_wb, work);
+
+    wb_flush(wb);
+}
+
+
+int wb_init(struct chdev_wb *wb, struct file *fp, size_t flush_bytes, unsigned int delay_ms)
+{
+    wb->buf = kmalloc(WB_BUF_SZ, GFP_KERNEL);
+    wb->spare = kmalloc(WB_BUF_SZ, GFP_KERNEL);
+    if (!wb->buf || !wb->spare) {
+        kfree(wb->buf);
+        kfree(wb->spare);
+        return -ENOMEM;
+    }
+
+    wb->fp = fp;
+    wb->off = 0;
+    wb->len = 0;
+    wb->err = 0;
+    wb->flush_bytes = clamp_t(size_t, flush_bytes, 1, WB_BUF_SZ);
+    wb->delay = msecs_to_jiffies(delay_ms);
+    spin_lock_init(&wb->lock);
+    mutex_init(&wb->flush_lock);
+    INIT_DELAYED_WORK(&wb->work, wb_worker);
+    return 0;
+}
+
+
+void wb_deinit(struct chdev_wb *wb)
+{
+    cancel_delayed_work_sync(&wb->work);
+    wb_flush(wb);
+
+    mutex_destroy(&wb->flush_lock);
+    kfree(wb->buf);
+    kfree(wb->spare);
+    wb->buf = NULL;
+    wb->spare = NULL;
+}
+
+
+int wb_append(struct chdev_wb *wb, const char *data, size_t len)
+{
+    bool kick = false;
+    int err = 0;
+
+    for (;;) {
+        spin_lock(&wb->lock);
+        if (wb->len + len <= WB_BUF_SZ) {
+            memcpy(wb->buf + wb->len, data, len);
+            wb->len += len;
+            kick = wb->len >= wb->flush_bytes;
+            spin_unlock(&wb->lock);
+            break;
+        }
+        spin_unlock(&wb->lock);
+
+        // The worker falls behind, write the batch out ourselves
+        if ((err = wb_flush(wb)))
+            return err;
+    }
+
+    if (kick)
+        mod_delayed_work(wb_wq, &wb->work, 0);
+    else
+        queue_delayed_work(wb_wq, &wb->work, wb->delay);
+    return 0;
+}
+
+
+/* Barrier: everything appended so far is written and synced to disk */
+int wb_sync(struct chdev_wb *wb)
+{
+    int err = wb_flush(wb);
+
+    if (!err)
+        err = vfs_fsync(wb->fp, 0);
+
+    mutex_lock(&wb->flush_lock);
+    wb->err = 0;
+    mutex_unlock(&wb->flush_lock);
+    return err;
+}
@@ -0,0 +1,49 @@
+#ifndef CDEV_WRITEBACK_H
+#define CDEV_WRITEBACK_H
+
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+
+/*
+ * Results destined for a work file are appended to a page-sized staging
+ * buffer and written out by a worker in batches: as soon as flush_bytes
+ * are staged or delay_ms after the first unwritten result. The worker
+ * swaps the staging buffer with a spare one, so producers only wait for
+ * a memcpy.
+ */
+struct chdev_wb {
+    struct file *fp;
+    loff_t off;
+
+    spinlock_t lock;            /* protects buf and len */
+    char *buf;
+    size_t len;
+
+    struct mutex flush_lock;    /* one writer of the work file at a time */
+    char *spare;
+    int err;                    /* first write error, reported by wb_sync() */
+
+    size_t flush_bytes;
+    unsigned long delay;
+    struct delayed_work work;
+};
+
+
+/* Woken whenever a batch reaches any work file */
+extern wait_queue_head_t wb_written_wq;
+
+
+int wb_module_init(void);
+void wb_module_exit(void);
+
+int wb_init(struct chdev_wb *wb, struct file *fp, size_t flush_bytes, unsigned int delay_ms);
+void wb_deinit(struct chdev_wb *wb);
+int wb_append(struct chdev_wb *wb, const char *data, size_t len);
+int wb_sync(struct chdev_wb *wb);
+
+#endif
@@ -0,0 +1,421 @@
+/*
+ * Memory bandwidth benchmark for /dev/memes<id> on NUMA hosts.
+ *
+ * Threads are pinned round-robin over the NUMA nodes and each streams
+ * O_DIRECT reads (or writes) over its own region of the disk, so every
+ * byte is one memcpy between the user buffer and a storage page. Pages
+ * are placed when first written: either by each thread (-f -1, local
+ * pages under numa_policy=0) or all from one CPU (-f <cpu>), which puts
+ * them on one node unless the disk interleaves. Reports the aggregate
+ * and per-node bandwidth.
+ *
+ * The data is pseudo-random: pages of one repeated word are kept by the
+ * disk as a single word, without a page to place. The run fails if the
+ * disk's same_pages count is not zero afterwards. `make bench-numa` runs
+ * the one-CPU fill under both numa_policy values.
+ *
+ * Without a multi-socket host the topology can be emulated in QEMU:
+ *
+ *   qemu-system-x86_64 -enable-kvm -smp 8,sockets=2,cores=4 -m 4G \
+ *       -object memory-backend-ram,id=m0,size=2G,host-nodes=0,policy=bind \
+ *       -object memory-backend-ram,id=m1,size=2G,host-nodes=1,policy=bind \
+ *       -numa node,nodeid=0,cpus=0-3,memdev=m0 \
+ *       -numa node,nodeid=1,cpus=4-7,memdev=m1 ...
+ *
+ * Bound to host nodes the guest sees real remote-access costs. Without
+ * host-nodes= the topology is only nominal and both policies perform
+ * alike. `numactl -H` in the guest shows the emulated distances.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define MAX_NODES 64
+
+static struct {
+    const char *dev;
+    unsigned int threads;
+    size_t block_sz;
+    size_t region_sz;       /* per thread */
+    unsigned int passes;
+    int write;
+    int fill_cpu;           /* -1: every thread fills its own region */
+} cfg = {
+    .dev = "/dev/memes0",
+    .threads = 0,
+    .block_sz = 1 << 20,
+    .region_sz = 64 << 20,
+    .passes = 20,
+    .write = 0,
+    .fill_cpu = -1,
+};
+
+struct worker {
+    pthread_t tid;
+    unsigned int id;
+    int cpu;
+    int node;
+    uint64_t bytes;
+    uint64_t elapsed_ns;
+    int err;
+};
+
+static pthread_barrier_t start_barrier;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/* The node a CPU belongs to, from its sysfs "node<N>" link */
+static int cpu_node(int cpu)
+{
+    char path[64];
+    struct dirent *de = NULL;
+    DIR *dir = NULL;
+    int node = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (!dir)
+        return 0;
+
+    while ((de = readdir(dir))) {
+        if (!strncmp(de->d_name, "node", 4)) {
+            node = atoi(de->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node < MAX_NODES ? node : 0;
+}
+
+
+/*
+ * Orders the CPUs by their rank within their node, then by node, so
+ * consecutive workers land on different nodes. Workers past the number
+ * of CPUs reuse the order.
+ */
+static int assign_cpus(struct worker *workers)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int *node_of = calloc(ncpus, sizeof(int));
+    int *order = calloc(ncpus, sizeof(int));
+    long n = 0;
+    long cpu = 0;
+    int rank = 0;
+    int node = 0;
+    unsigned int t = 0;
+
+    if (!node_of || !order) {
+        free(node_of);
+        free(order);
+        return -ENOMEM;
+    }
+
+    for (cpu = 0; cpu < ncpus; cpu++)
+        node_of[cpu] = cpu_node(cpu);
+
+    for (rank = 0; n < ncpus; rank++) {
+        for (node = 0; node < MAX_NODES; node++) {
+            int seen = 0;
+
+            for (cpu = 0; cpu < ncpus; cpu++) {
+                if (node_of[cpu] == node && seen++ == rank) {
+                    order[n++] = cpu;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (t = 0; t < cfg.threads; t++) {
+        workers[t].cpu = order[t % ncpus];
+        workers[t].node = node_of[workers[t].cpu];
+    }
+
+    free(node_of);
+    free(order);
+    return 0;
+}
+
+
+static int pin_to(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return -pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+
+static int stream(int fd, char *buf, off_t base, int write, uint64_t *bytes)
+{
+    size_t done = 0;
+
+    for (done = 0; done < cfg.region_sz; done += cfg.block_sz) {
+        ssize_t n = write
+            ? pwrite(fd, buf, cfg.block_sz, base + done)
+            : pread(fd, buf, cfg.block_sz, base + done);
+
+        if (n != (ssize_t)cfg.block_sz)
+            return n < 0 ? -errno : -EIO;
+        *bytes += n;
+    }
+    return 0;
+}
+
+
+/* Distinct words, so no page of the disk is same-filled */
+static void fill_buf(char *buf, uint64_t seed)
+{
+    uint64_t *words = (uint64_t *)buf;
+    size_t i = 0;
+
+    for (i = 0; i < cfg.block_sz / sizeof(*words); i++) {
+        uint64_t x = seed + (i + 1) * 0x9e3779b97f4a7c15ull;
+
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        words[i] = x ^ (x >> 31);
+    }
+}
+
+
+static int open_dev(char **buf, uint64_t seed)
+{
+    int fd = open(cfg.dev, O_RDWR | O_DIRECT);
+
+    if (fd < 0)
+        return -errno;
+
+    if (posix_memalign((void **)buf, 4096, cfg.block_sz)) {
+        close(fd);
+        return -ENOMEM;
+    }
+    fill_buf(*buf, seed);
+    return fd;
+}
+
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    off_t base = (off_t)w->id * cfg.region_sz;
+    uint64_t filled = 0;
+    uint64_t start = 0;
+    unsigned int pass = 0;
+    char *buf = NULL;
+    int fd = -1;
+
+    w->err = pin_to(w->cpu);
+    if (!w->err) {
+        fd = open_dev(&buf, w->id + 1);
+        if (fd < 0)
+            w->err = fd;
+    }
+    if (!w->err && cfg.fill_cpu < 0)
+        w->err = stream(fd, buf, base, 1, &filled);
+
+    /* Everybody waits, failed workers included */
+    pthread_barrier_wait(&start_barrier);
+
+    start = now_ns();
+    for (pass = 0; pass < cfg.passes && !w->err; pass++)
+        w->err = stream(fd, buf, base, cfg.write, &w->bytes);
+    w->elapsed_ns = now_ns() - start;
+
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+
+/* Writes every region from one CPU, before the workers start */
+static int fill_from(int cpu)
+{
+    uint64_t filled = 0;
+    unsigned int t = 0;
+    char *buf = NULL;
+    int fd = 0;
+    int err = pin_to(cpu);
+
+    if (err)
+        return err;
+
+    fd = open_dev(&buf, 0);
+    if (fd < 0)
+        return fd;
+
+    for (t = 0; t < cfg.threads && !err; t++)
+        err = stream(fd, buf, (off_t)t * cfg.region_sz, 1, &filled);
+
+    close(fd);
+    free(buf);
+    return err;
+}
+
+
+/* same_pages of the disk from sysfs, -1 when it can not be read */
+static long long same_pages(void)
+{
+    const char *name = strrchr(cfg.dev, '/');
+    char path[128];
+    long long pages = -1;
+    FILE *f = NULL;
+
+    snprintf(path, sizeof(path), "/sys/block/%s/same_pages",
+             name ? name + 1 : cfg.dev);
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (fscanf(f, "%lld", &pages) != 1)
+        pages = -1;
+    fclose(f);
+    return pages;
+}
+
+
+static void report(struct worker *workers)
+{
+    uint64_t node_bytes[MAX_NODES] = { 0 };
+    uint64_t node_ns[MAX_NODES] = { 0 };
+    uint64_t bytes = 0;
+    uint64_t max_ns = 1;
+    unsigned int t = 0;
+    int node = 0;
+
+    for (t = 0; t < cfg.threads; t++) {
+        struct worker *w = &workers[t];
+
+        bytes += w->bytes;
+        node_bytes[w->node] += w->bytes;
+        if (w->elapsed_ns > node_ns[w->node])
+            node_ns[w->node] = w->elapsed_ns;
+        if (w->elapsed_ns > max_ns)
+            max_ns = w->elapsed_ns;
+    }
+
+    printf("%s, threads %u, block %zu, region %zu MiB, filled from %s\n",
+           cfg.write ? "write" : "read", cfg.threads, cfg.block_sz,
+           cfg.region_sz >> 20, cfg.fill_cpu < 0 ? "every thread" : "one CPU");
+    printf("total: %.1f MB/s\n", bytes / (max_ns / 1e9) / 1e6);
+    for (node = 0; node < MAX_NODES; node++) {
+        if (node_ns[node])
+            printf("node %d: %.1f MB/s\n", node,
+                   node_bytes[node] / (node_ns[node] / 1e9) / 1e6);
+    }
+}
+
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -D path   device (%s)\n"
+            "  -t n      threads, pinned round-robin over nodes (online CPUs)\n"
+            "  -s bytes  size of a read or write, page multiple (%zu)\n"
+            "  -r MiB    region of each thread (%zu)\n"
+            "  -n n      passes over the region (%u)\n"
+            "  -m mode   read or write (read)\n"
+            "  -f cpu    fill every region from this CPU, -1: each thread (%d)\n",
+            prog, cfg.dev, cfg.block_sz, cfg.region_sz >> 20, cfg.passes,
+            cfg.fill_cpu);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct worker *workers = NULL;
+    long long same = 0;
+    unsigned int t = 0;
+    int ret = 0;
+    int opt = 0;
+
+    cfg.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "D:t:s:r:n:m:f:h")) != -1) {
+        switch (opt) {
+            case 'D': cfg.dev = optarg; break;
+            case 't': cfg.threads = strtoul(optarg, NULL, 0); break;
+            case 's': cfg.block_sz = strtoul(optarg, NULL, 0); break;
+            case 'r': cfg.region_sz = strtoul(optarg, NULL, 0) << 20; break;
+            case 'n': cfg.passes = strtoul(optarg, NULL, 0); break;
+            case 'm': cfg.write = !strcmp(optarg, "write"); break;
+            case 'f': cfg.fill_cpu = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!cfg.threads || !cfg.block_sz || cfg.block_sz % 4096 || !cfg.passes
+        || !cfg.region_sz || cfg.region_sz % cfg.block_sz) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    workers = calloc(cfg.threads, sizeof(*workers));
+    if (!workers) {
+        perror("calloc");
+        return 1;
+    }
+    for (t = 0; t < cfg.threads; t++)
+        workers[t].id = t;
+    if (assign_cpus(workers)) {
+        perror("calloc");
+        free(workers);
+        return 1;
+    }
+
+    if (cfg.fill_cpu >= 0 && (ret = fill_from(cfg.fill_cpu))) {
+        fprintf(stderr, "fill: %s\n", strerror(-ret));
+        free(workers);
+        return 1;
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, cfg.threads);
+    for (t = 0; t < cfg.threads; t++)
+        pthread_create(&workers[t].tid, NULL, worker_main, &workers[t]);
+    for (t = 0; t < cfg.threads; t++)
+        pthread_join(workers[t].tid, NULL);
+    pthread_barrier_destroy(&start_barrier);
+
+    report(workers);
+
+    same = same_pages();
+    if (same > 0) {
+        fprintf(stderr, "%lld same-filled pages, placement was not measured\n",
+                same);
+        ret = 1;
+    } else if (same < 0) {
+        fprintf(stderr, "same_pages unavailable, data pages not checked\n");
+    }
+
+    for (t = 0; t < cfg.threads; t++) {
+        if (workers[t].err) {
+            fprintf(stderr, "thread %u: %s\n", t, strerror(-workers[t].err));
+            ret = 1;
+        }
+    }
+    free(workers);
+    return ret;
+}
@@ -0,0 +1,286 @@
+#include <linux/bitops.h>
+#include <linux/err.h>
+#include <linux/falloc.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DRV_LOG_DISABLE_DEBUG
+
+#include "backing.h"
+#include "constants.h"
+#include "logging.h"
+
+
+static void drv_backing_wb_work(struct work_struct * work);
+
+
+int drv_backing_open(struct drv_backing * b,
+                     struct drv_storage * st,
+                     const char * path,
+                     u64 size,
+                     const char * name,
+                     unsigned int wb_delay_ms)
+{
+    unsigned long nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+    int status = 0;
+    DRV_LOG_CTX_SET("drv_backing_open");
+
+    b->st = st;
+    b->size = size;
+    b->wb_delay = msecs_to_jiffies(wb_delay_ms);
+    mutex_init(&b->load_lock);
+    mutex_init(&b->wb_lock);
+    INIT_DELAYED_WORK(&b->wb_work, drv_backing_wb_work);
+
+    LG_DBG("Open backing file");
+    b->fp = filp_open(path, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+    if (IS_ERR(b->fp)) {
+        LG_FAILED_TO("open backing file");
+        status = PTR_ERR(b->fp);
+        b->fp = NULL;
+        return status;
+    }
+
+    b->loaded = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+    b->load_buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    b->wb_buf = vmalloc(DRV_STORAGE_DIRTY_BATCH * PAGE_SIZE);
+    b->wq = alloc_workqueue("%s", WQ_MEM_RECLAIM | WQ_UNBOUND, 0, name);
+    if (!b->loaded || !b->load_buf || !b->wb_buf || !b->wq) {
+        LG_FAILED_TO("allocate backing file buffers");
+        goto undo_alloc;
+    }
+
+    return DRV_OP_SUCCESS;
+
+undo_alloc:
+    if (b->wq)
+        destroy_workqueue(b->wq);
+    vfree(b->wb_buf);
+    kfree(b->load_buf);
+    vfree(b->loaded);
+    filp_close(b->fp, NULL);
+    b->fp = NULL;
+    return -ENOMEM;
+}
+
+
+static int drv_backing_load_page(struct drv_backing * b, pgoff_t idx)
+{
+    u64 off = (u64)idx << PAGE_SHIFT;
+    int nread = 0;
+    int status = 0;
+
+    mutex_lock(&b->load_lock);
+    if (test_bit(idx, b->loaded))
+        goto out;
+
+    nread = kernel_read(b->fp, off, b->load_buf, PAGE_SIZE);
+    if (nread < 0) {
+        status = nread;
+        goto out;
+    }
+    // Past the end of the file the disk reads as zeros
+    memset(b->load_buf + nread, 0, PAGE_SIZE - nread);
+
+    status = drv_storage_fill(b->st, off, b->load_buf, PAGE_SIZE, GFP_NOIO);
+    if (status)
+        goto out;
+
+    // Pairs with smp_rmb() in drv_backing_load()
+    smp_wmb();
+    set_bit(idx, b->loaded);
+out:
+    mutex_unlock(&b->load_lock);
+    return status;
+}
+
+
+int drv_backing_load(struct drv_backing * b, u64 off, u64 len)
+{
+    pgoff_t idx = off >> PAGE_SHIFT;
+    pgoff_t end = DIV_ROUND_UP(off + len, PAGE_SIZE);
+    int status = 0;
+
+    for (; idx < end; idx++) {
+        if (test_bit(idx, b->loaded))
+            continue;
+
+        status = drv_backing_load_page(b, idx);
+        if (status)
+            return status;
+    }
+
+    smp_rmb();
+    return DRV_OP_SUCCESS;
+}
+
+
+/*
+ * Waits for a load of the range that is reading the file, so it fills
+ * the storage before the discard punches and forgets the pages, not
+ * after.
+ */
+void drv_backing_mark_loaded(struct drv_backing * b, u64 off, u64 len)
+{
+    pgoff_t idx = DIV_ROUND_UP(off, PAGE_SIZE);
+    pgoff_t end = (off + len) >> PAGE_SHIFT;
+
+    mutex_lock(&b->load_lock);
+    for (; idx < end; idx++)
+        set_bit(idx, b->loaded);
+    mutex_unlock(&b->load_lock);
+}
+
+
+static int drv_backing_write_run(struct drv_backing * b,
+                                 pgoff_t first,
+                                 unsigned int nr_pages)
+{
+    size_t len = (size_t)nr_pages * PAGE_SIZE;
+    ssize_t written = 0;
+    unsigned int i = 0;
+
+    written = kernel_write(b->fp, b->wb_buf, len, (loff_t)first << PAGE_SHIFT);
+    if (written == (ssize_t)len)
+        return DRV_OP_SUCCESS;
+
+    for (i = 0; i < nr_pages; i++)
+        drv_storage_redirty(b->st, first + i);
+    return written < 0 ? written : -EIO;
+}
+
+
+/*
+ * One pass over the dirty pages in index order. Each run of contiguous
+ * dirty pages is copied out and written with a single call.
+ */
+static int drv_backing_writeback(struct drv_backing * b)
+{
+    pgoff_t indices[DRV_STORAGE_DIRTY_BATCH];
+    pgoff_t start = 0;
+    unsigned int nr = 0;
+    unsigned int run = 0;
+    unsigned int i = 0;
+    int status = 0;
+
+    mutex_lock(&b->wb_lock);
+    while (!status) {
+        nr = drv_storage_dirty(b->st, start, indices, DRV_STORAGE_DIRTY_BATCH);
+        if (!nr)
+            break;
+
+        for (i = 0; i < nr && !status; i += run) {
+            int clean_status = 0;
+
+            for (run = 0; i + run < nr && indices[i + run] == indices[i] + run;
+                 run++) {
+                clean_status = drv_storage_clean(
+                    b->st, indices[i + run], b->wb_buf + run * PAGE_SIZE);
+                if (clean_status)
+                    break;
+            }
+
+            if (run)
+                status = drv_backing_write_run(b, indices[i], run);
+            if (!status)
+                status = clean_status;
+        }
+        start = indices[nr - 1] + 1;
+    }
+    mutex_unlock(&b->wb_lock);
+
+    return status;
+}
+
+
+static void drv_backing_wb_work(struct work_struct * work)
+{
+    struct drv_backing * b
+        = container_of(to_delayed_work(work), struct drv_backing, wb_work);
+    DRV_LOG_CTX_SET("drv_backing_wb_work");
+
+    // Failed pages stay dirty and are retried after the next write
+    if (drv_backing_writeback(b) < 0)
+        LG_FAILED_TO("write back dirty pages");
+}
+
+
+/*
+ * Punching and dropping happen under wb_lock, so no writeback pass can
+ * write a copy of a dropped page over the hole.
+ */
+static int drv_backing_punch(struct drv_backing * b, u64 off, u64 len)
+{
+    int status = 0;
+
+    mutex_lock(&b->wb_lock);
+    status = vfs_fallocate(
+        b->fp, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len);
+    if (!status)
+        drv_storage_forget(b->st, off, len);
+    mutex_unlock(&b->wb_lock);
+
+    return status;
+}
+
+
+int drv_backing_discard(struct drv_backing * b, u64 off, u64 len)
+{
+    u64 end = off + len;
+    u64 first = round_up(off, PAGE_SIZE);
+    u64 last = round_down(end, PAGE_SIZE);
+    int status = 0;
+
+    if (first >= last)
+        return drv_storage_discard(b->st, off, len, GFP_NOIO);
+
+    if (off < first)
+        status = drv_storage_discard(b->st, off, first - off, GFP_NOIO);
+    if (!status && last < end)
+        status = drv_storage_discard(b->st, last, end - last, GFP_NOIO);
+
+    // Without hole punching the pages are written back as zeros
+    if (!status && drv_backing_punch(b, first, last - first))
+        status = drv_storage_discard(b->st, first, last - first, GFP_NOIO);
+
+    return status;
+}
+
+
+void drv_backing_kick(struct drv_backing * b)
+{
+    queue_delayed_work(b->wq, &b->wb_work, b->wb_delay);
+}
+
+
+int drv_backing_flush(struct drv_backing * b)
+{
+    int status = drv_backing_writeback(b);
+
+    if (status)
+        return status;
+    return vfs_fsync(b->fp, 0);
+}
+
+
+void drv_backing_close(struct drv_backing * b)
+{
+    DRV_LOG_CTX_SET("drv_backing_close");
+
+    if (!b->fp)
+        return;
+
+    // I/O still queued by the disk may dirty more pages
+    flush_workqueue(b->wq);
+    cancel_delayed_work_sync(&b->wb_work);
+    if (drv_backing_flush(b) < 0)
+        LG_FAILED_TO("write back the disk on close");
+
+    destroy_workqueue(b->wq);
+    vfree(b->wb_buf);
+    kfree(b->load_buf);
+    vfree(b->loaded);
+    filp_close(b->fp, NULL);
+    b->fp = NULL;
+}
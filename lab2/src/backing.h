@@ -0,0 +1,64 @@
+#ifndef BACKING_H
+#define BACKING_H
+
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "storage.h"
+
+
+/*
+ * Backing file of a disk. Pages are read in from the file on their first
+ * access and dirty pages are written back in the background, in runs of
+ * contiguous pages. Every call may sleep.
+ */
+struct drv_backing
+{
+    struct file * fp; // NULL when the disk has no backing file
+    struct drv_storage * st;
+    u64 size;
+    unsigned long * loaded; // bitmap of pages read from the file
+    struct mutex load_lock;
+    char * load_buf;
+    struct workqueue_struct * wq;
+    struct delayed_work wb_work;
+    struct mutex wb_lock; // serializes writeback passes
+    char * wb_buf; // DRV_STORAGE_DIRTY_BATCH pages
+    unsigned long wb_delay; // jiffies
+};
+
+
+int drv_backing_open(struct drv_backing * b,
+                     struct drv_storage * st,
+                     const char * path,
+                     u64 size,
+                     const char * name,
+                     unsigned int wb_delay_ms);
+void drv_backing_close(struct drv_backing * b);
+
+// Reads every page of [off, off + len) that is not loaded yet
+int drv_backing_load(struct drv_backing * b, u64 off, u64 len);
+
+// Marks the whole pages of the range loaded without reading them
+void drv_backing_mark_loaded(struct drv_backing * b, u64 off, u64 len);
+
+/*
+ * Zeroes the range. Whole pages are dropped from memory and punched out
+ * of the file, partial ones are zeroed and written back.
+ */
+int drv_backing_discard(struct drv_backing * b, u64 off, u64 len);
+
+/*
+ * Schedules a writeback pass wb_delay after the write, unless one is
+ * already pending. Later writes do not push a pending pass back, so the
+ * delay bounds how long a page stays dirty even under constant writes.
+ */
+void drv_backing_kick(struct drv_backing * b);
+
+// Writes back every dirty page and syncs the file
+int drv_backing_flush(struct drv_backing * b);
+
+
+#endif
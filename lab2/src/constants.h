@@ -5,9 +5,21 @@
 #define DRV_DISKNAME_MAX 32
 
 #define DRV_OP_SUCCESS 0
-#define DRV_NSECTORS 100 * 1024 * 2
+#define DRV_DISK_MB 100
 #define DRV_SECTOR_SZ 512
-#define DRV_MINORS 16
+#define DRV_MINORS 16 // per disk, partitions first then snapshots
+#define DRV_PART_MINORS 8
+#define DRV_SNAPSHOTS (DRV_MINORS - DRV_PART_MINORS)
+#define DRV_DEVICES 1
+#define DRV_MAX_DEVICES 16
+#define DRV_QUEUE_DEPTH 128
+#define DRV_WB_DELAY_MS 1000
+
+#define DRV_QUEUE_BIO 0
+#define DRV_QUEUE_MQ 1
+
+#define DRV_NUMA_LOCAL 0
+#define DRV_NUMA_INTERLEAVE 1
 
 #define KERNEL_SECTOR_SIZE 512
 
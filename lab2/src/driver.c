@@ -1,43 +1,144 @@
+#include <linux/blk-mq.h>
 #include <linux/blkdev.h>
 #include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/hdreg.h>
+#include <linux/highmem.h>
 #include <linux/kdev_t.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 #include <linux/module.h>
-#include <linux/spinlock.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/sysfs.h>
 #include <linux/types.h>
 #include <linux/version.h>
-#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #define DRV_LOG_DISABLE_DEBUG
 
+#include "backing.h"
 #include "constants.h"
 #include "logging.h"
+#include "stats.h"
+#include "storage.h"
 
 
+// Per-disk settings, from module parameters or the add_device control
+struct drv_blkdev_config
+{
+    u64 size;
+    unsigned int block_size;
+    unsigned int queue_depth;
+    const char * backing_path; // NULL for a purely in-memory disk
+    struct drv_blkdev * origin; // disk to snapshot, NULL for a new disk
+};
+
+// blk-mq request payload, used to serve requests from a workqueue
+struct drv_cmd
+{
+    struct work_struct work;
+    u64 start; // ktime_get_ns() at dispatch, for the latency stats
+};
+
 struct drv_blkdev
 {
+    int id;
+    int first_minor;
     int minors;
+    char name[DRV_DISKNAME_MAX];
     struct gendisk * gd;
     struct request_queue * queue;
-    char * vdisk;
-    size_t size;
-    spinlock_t lock;
+    struct drv_storage storage;
+    struct drv_stats stats;
+    struct drv_backing backing;
+    spinlock_t bio_lock; // guards bios
+    struct bio_list bios; // bio mode, waiting for bio_work
+    struct work_struct bio_work;
+    u64 size;
+    unsigned int block_size;
+    unsigned int queue_mode;
+    struct blk_mq_tag_set tag_set; // DRV_QUEUE_MQ only
+    struct drv_blkdev * snapshots[DRV_SNAPSHOTS]; // guarded by devices_lock
 };
 
 static struct
 {
     int blk_major;
-    struct drv_blkdev blkdev;
+    struct mutex devices_lock; // guards devices and ready
+    struct drv_blkdev * devices[DRV_MAX_DEVICES];
+    bool ready; // disks may be added and removed
+    struct workqueue_struct * wq; // requests retried out of queue_rq()
     struct block_device_operations blk_ops;
-} module_globals = {.blk_major = 0,
-                    .blkdev = {.vdisk = NULL,
-                               .queue = NULL,
-                               .size = 0,
-                               .gd = NULL,
-                               .minors = DRV_MINORS},
-                    .blk_ops = {.owner = THIS_MODULE}};
+} module_globals
+    = {.blk_major = 0,
+       .devices_lock = __MUTEX_INITIALIZER(module_globals.devices_lock),
+       .devices = {NULL},
+       .ready = false,
+       .blk_ops = {.owner = THIS_MODULE}};
+
+
+static unsigned int nr_devices = DRV_DEVICES;
+module_param_named(devices, nr_devices, uint, 0444);
+MODULE_PARM_DESC(devices, "Number of disks created at load time");
+
+/*
+ * Per-disk array parameters. Disks past the last given value reuse it,
+ * so a single value applies to every disk.
+ */
+static unsigned long disk_mb[DRV_MAX_DEVICES];
+static unsigned int nr_disk_mb = 0;
+module_param_array(disk_mb, ulong, &nr_disk_mb, 0444);
+MODULE_PARM_DESC(disk_mb, "Capacity of each disk in MiB, allocated on write");
+
+static unsigned int block_size[DRV_MAX_DEVICES];
+static unsigned int nr_block_size = 0;
+module_param_array(block_size, uint, &nr_block_size, 0444);
+MODULE_PARM_DESC(block_size, "Logical block size of each disk, 512 to 4096");
+
+static unsigned int queue_depth[DRV_MAX_DEVICES];
+static unsigned int nr_queue_depth = 0;
+module_param_array(queue_depth, uint, &nr_queue_depth, 0444);
+MODULE_PARM_DESC(queue_depth, "Number of tags (in-flight requests) per queue");
+
+#define DRV_PARAM_AT(values, n, i, def) \
+    ((n) ? (values)[min((i), (n)-1)] : (def))
+
+// Unlike the other arrays, a missing or empty entry means no backing file
+static char * backing_file[DRV_MAX_DEVICES];
+static unsigned int nr_backing_file = 0;
+module_param_array(backing_file, charp, &nr_backing_file, 0444);
+MODULE_PARM_DESC(backing_file, "File each disk is loaded from and saved to");
+
+static unsigned int wb_delay_ms = DRV_WB_DELAY_MS;
+module_param(wb_delay_ms, uint, 0444);
+MODULE_PARM_DESC(wb_delay_ms, "Longest time a written page stays dirty, in ms");
+
+static bool compress = false;
+module_param(compress, bool, 0444);
+MODULE_PARM_DESC(compress, "Store pages LZ4-compressed in a zsmalloc pool");
+
+static bool dax = false;
+module_param(dax, bool, 0444);
+MODULE_PARM_DESC(dax, "Support direct access (DAX), excludes compression");
+
+static unsigned int queue_mode = DRV_QUEUE_MQ;
+module_param(queue_mode, uint, 0444);
+MODULE_PARM_DESC(queue_mode, "0: bio based, 1: blk-mq requests");
+
+static unsigned int hw_queues = 0;
+module_param(hw_queues, uint, 0444);
+MODULE_PARM_DESC(hw_queues, "Number of hardware queues, 0 for one per CPU");
+
+/*
+ * Local placement relies on I/O being served on the submitting CPU: true
+ * in bio mode and with the default one hardware queue per CPU.
+ */
+static unsigned int numa_policy = DRV_NUMA_LOCAL;
+module_param(numa_policy, uint, 0444);
+MODULE_PARM_DESC(numa_policy, "0: pages on the writer's node, 1: interleaved");
 
 
 int drv_ioctl(struct inode * inode,
@@ -45,6 +146,7 @@ int drv_ioctl(struct inode * inode,
               unsigned int cmd,
               unsigned long arg)
 {
+    struct drv_blkdev * blkdev = inode->i_bdev->bd_disk->private_data;
     long size;
     struct hd_geometry geo;
     DRV_LOG_CTX_SET("drv_ioctl");
@@ -57,8 +159,7 @@ int drv_ioctl(struct inode * inode,
 	 */
         case HDIO_GETGEO:
             LG_DBG("retreiving disk geo");
-            size = module_globals.blkdev.size
-                   * (DRV_SECTOR_SZ / KERNEL_SECTOR_SIZE);
+            size = blkdev->size * (DRV_SECTOR_SZ / KERNEL_SECTOR_SIZE);
             geo.cylinders = (size & ~0x3f) >> 6;
             geo.heads = 4;
             geo.sectors = 16;
@@ -76,16 +177,16 @@ int drv_ioctl(struct inode * inode,
 
 static int drv_transfer(struct drv_blkdev * blkdev,
                         sector_t sector,
-                        size_t nsect,
+                        size_t nbytes,
                         char * buf,
-                        int write)
+                        int write,
+                        gfp_t gfp)
 {
-    size_t off = sector * DRV_SECTOR_SZ;
-    size_t nbytes = nsect * DRV_SECTOR_SZ;
+    u64 off = (u64)sector * KERNEL_SECTOR_SIZE;
     DRV_LOG_CTX_SET("drv_transfer");
 
 #ifndef DRV_LOG_DISABLE_DEBUG
-    printk(KERN_DEBUG "drv_transfer: params: off: %lu, nbytes: %lu\n",
+    printk(KERN_DEBUG "drv_transfer: params: off: %llu, nbytes: %zu\n",
            off,
            nbytes);
 
@@ -101,45 +202,461 @@ static int drv_transfer(struct drv_blkdev * blkdev,
     }
 
     if (write)
-        memcpy(blkdev->vdisk + off, buf, nbytes);
+        return drv_storage_write(&blkdev->storage, off, buf, nbytes, gfp);
+
+    return drv_storage_read(&blkdev->storage, off, buf, nbytes);
+}
+
+
+static int drv_discard(struct drv_blkdev * blkdev,
+                       sector_t sector,
+                       u64 nbytes,
+                       gfp_t gfp)
+{
+    u64 off = (u64)sector * KERNEL_SECTOR_SIZE;
+    DRV_LOG_CTX_SET("drv_discard");
+
+    if ((off + nbytes) > blkdev->size) {
+        LG_FAILED_TO("discard. Out of bound.");
+        return -ENOSPC;
+    }
+
+    if (blkdev->backing.fp)
+        return drv_backing_discard(&blkdev->backing, off, nbytes);
+    return drv_storage_discard(&blkdev->storage, off, nbytes, gfp);
+}
+
+
+/*
+ * Bio pages stay mapped across storage calls, which sleep on allocation
+ * failures when gfp allows it. kmap_atomic() would forbid that.
+ */
+static char * drv_kmap(struct page * page, gfp_t gfp)
+{
+    return gfpflags_allow_blocking(gfp) ? kmap(page) : kmap_atomic(page);
+}
+
+
+static void drv_kunmap(struct page * page, char * addr, gfp_t gfp)
+{
+    if (gfpflags_allow_blocking(gfp))
+        kunmap(page);
     else
-        memcpy(buf, blkdev->vdisk + off, nbytes);
+        kunmap_atomic(addr);
+}
+
+
+/*
+ * 4.4 has no WRITE_ZEROES, blkdev_issue_zeroout() falls back to WRITE_SAME.
+ * The bio carries one logical block that is replicated over the range;
+ * an all-zero block is turned into a discard so no memory is allocated.
+ */
+static int drv_write_same_bio(struct drv_blkdev * blkdev,
+                              struct bio * bio,
+                              gfp_t gfp)
+{
+    struct bio_vec bvec = bio_iovec(bio);
+    sector_t sector = bio->bi_iter.bi_sector;
+    u64 nbytes = bio->bi_iter.bi_size;
+    char * buf = drv_kmap(bvec.bv_page, gfp);
+    char * pattern = buf + bvec.bv_offset;
+    int status = 0;
+
+    if (!memchr_inv(pattern, 0, bvec.bv_len)) {
+        status = drv_discard(blkdev, sector, nbytes, gfp);
+    } else {
+        while (nbytes && !status) {
+            status = drv_transfer(
+                blkdev, sector, bvec.bv_len, pattern, 1, gfp);
+            sector += bvec.bv_len / KERNEL_SECTOR_SIZE;
+            nbytes -= bvec.bv_len;
+        }
+    }
+    drv_kunmap(bvec.bv_page, buf, gfp);
+
+    return status;
+}
+
+
+/*
+ * DAX entry point: hands out the backing page of the sector, allocating
+ * it on first access. Pages of pinned storage stay put until rmmod. Called
+ * from process context, the allocation may sleep.
+ */
+static long drv_direct_access(struct block_device * bdev,
+                              sector_t sector,
+                              void __pmem ** kaddr,
+                              unsigned long * pfn)
+{
+    struct drv_blkdev * blkdev = bdev->bd_disk->private_data;
+    u64 off = (u64)sector * KERNEL_SECTOR_SIZE;
+    struct page * page = NULL;
+
+    if (off >= blkdev->size)
+        return -ERANGE;
+
+    page = drv_storage_page(&blkdev->storage, off >> PAGE_SHIFT, GFP_NOIO);
+    if (!page)
+        return -ENOMEM;
 
-    return 0;
+    *kaddr = (void __pmem *)(page_address(page) + offset_in_page(off));
+    *pfn = page_to_pfn(page);
+    return PAGE_SIZE - offset_in_page(off);
 }
 
 
-static void drv_request_handler(struct request_queue * queue)
+/*
+ * Walks every segment of the bio. Segment pages may live in highmem and
+ * are mapped one at a time.
+ */
+static int drv_transfer_bio(struct drv_blkdev * blkdev,
+                            struct bio * bio,
+                            gfp_t gfp)
 {
-    struct request * rq = NULL;
-    struct drv_blkdev * blkdev = queue->queuedata;
-    int blk_op_status = 0;
+    struct bvec_iter iter;
+    struct bio_vec bvec;
+    int write = bio_data_dir(bio);
+    int status = 0;
 
-    DRV_LOG_CTX_SET("drv_request_handler");
+    bio_for_each_segment(bvec, bio, iter)
+    {
+        char * buf = drv_kmap(bvec.bv_page, gfp);
+        status = drv_transfer(blkdev,
+                              iter.bi_sector,
+                              bvec.bv_len,
+                              buf + bvec.bv_offset,
+                              write,
+                              gfp);
+        drv_kunmap(bvec.bv_page, buf, gfp);
 
-    rq = blk_fetch_request(queue);
-    for (;;) {
-        if (rq == NULL)
+        if (status)
             break;
+        if (!write)
+            flush_dcache_page(bvec.bv_page);
+    }
 
-        if (rq->cmd_type != REQ_TYPE_FS) {
-            LG_WRN("Skip non-fs request");
-            __blk_end_request_all(rq, -EIO);
-            continue;
-        }
+    return status;
+}
+
+
+/*
+ * Brings the pages a bio touches in from the backing file. Pages wholly
+ * covered by a discard are not read, they are about to be zeroed.
+ */
+static int drv_bio_load(struct drv_blkdev * blkdev, struct bio * bio)
+{
+    u64 off = (u64)bio->bi_iter.bi_sector * KERNEL_SECTOR_SIZE;
+    u64 end = off + bio->bi_iter.bi_size;
+    u64 first = round_up(off, PAGE_SIZE);
+    u64 last = round_down(end, PAGE_SIZE);
+    int status = 0;
+
+    // Out of bound bios are rejected by the handlers
+    if (!blkdev->backing.fp || end > blkdev->size)
+        return 0;
+
+    if (!(bio->bi_rw & REQ_DISCARD) || first >= last)
+        return drv_backing_load(&blkdev->backing, off, end - off);
+
+    status = drv_backing_load(&blkdev->backing, off, first - off);
+    if (!status)
+        status = drv_backing_load(&blkdev->backing, last, end - last);
+    drv_backing_mark_loaded(&blkdev->backing, first, last - first);
+    return status;
+}
+
+
+// Bio and request flags share the REQ_* bits
+static enum drv_stats_dir drv_stats_dir(u64 flags)
+{
+    if (flags & REQ_DISCARD)
+        return DRV_STATS_DISCARD;
+    return (flags & REQ_WRITE) ? DRV_STATS_WRITE : DRV_STATS_READ;
+}
+
+
+/*
+ * Common to the request (blk-mq) and bio queue modes. gfp tells whether
+ * the caller may sleep for memory; when it may not, -ENOMEM is returned
+ * and the bio must be served again from a context that may.
+ */
+static int drv_handle_bio(struct drv_blkdev * blkdev,
+                          struct bio * bio,
+                          gfp_t gfp)
+{
+    int status = drv_bio_load(blkdev, bio);
+
+    if (status)
+        return status;
+
+    if (bio->bi_rw & REQ_DISCARD)
+        status = drv_discard(
+            blkdev, bio->bi_iter.bi_sector, bio->bi_iter.bi_size, gfp);
+    else if (bio->bi_rw & REQ_WRITE_SAME)
+        status = drv_write_same_bio(blkdev, bio, gfp);
+    else
+        status = drv_transfer_bio(blkdev, bio, gfp);
+
+    if (!status && bio_data_dir(bio) && blkdev->backing.fp)
+        drv_backing_kick(&blkdev->backing);
+    return status;
+}
+
+
+static int drv_flush(struct drv_blkdev * blkdev)
+{
+    if (!blkdev->backing.fp)
+        return 0;
+    return drv_backing_flush(&blkdev->backing);
+}
+
+
+/*
+ * Bio mode has no merging, a bio is accounted as one request. Bios are
+ * submitted from process context, storage may sleep for memory.
+ */
+static int drv_serve_bio(struct drv_blkdev * blkdev, struct bio * bio)
+{
+    u64 start = ktime_get_ns();
+    u64 nbytes = bio->bi_iter.bi_size;
+    int status = 0;
+
+    if (bio->bi_rw & REQ_FLUSH)
+        status = drv_flush(blkdev);
+    if (!status && nbytes)
+        status = drv_handle_bio(blkdev, bio, GFP_NOIO);
+    if (!status && (bio->bi_rw & REQ_FUA))
+        status = drv_flush(blkdev);
+
+    if (nbytes)
+        drv_stats_account(&blkdev->stats,
+                          drv_stats_dir(bio->bi_rw),
+                          nbytes,
+                          ktime_get_ns() - start,
+                          status);
+    return status;
+}
 
-        blk_op_status = drv_transfer(blkdev,
-                                     blk_rq_pos(rq),
-                                     blk_rq_cur_sectors(rq),
-                                     bio_data(rq->bio),
-                                     rq_data_dir(rq));
 
-        if (!__blk_end_request_cur(rq, blk_op_status))
-            rq = blk_fetch_request(queue);
+// Serves the bios queued by drv_make_request() for a backed disk
+static void drv_bio_work(struct work_struct * work)
+{
+    struct drv_blkdev * blkdev
+        = container_of(work, struct drv_blkdev, bio_work);
+    struct bio_list bios;
+    struct bio * bio = NULL;
+
+    bio_list_init(&bios);
+    spin_lock_irq(&blkdev->bio_lock);
+    bio_list_merge(&bios, &blkdev->bios);
+    bio_list_init(&blkdev->bios);
+    spin_unlock_irq(&blkdev->bio_lock);
+
+    while ((bio = bio_list_pop(&bios))) {
+        bio->bi_error = drv_serve_bio(blkdev, bio);
+        bio_endio(bio);
+    }
+}
+
+
+/*
+ * Bio mode: bios are served as they are submitted, without request
+ * allocation, plugging, merging or tags. The copy is all the work there
+ * is for a ramdisk, so nothing is gained by batching. Backing file I/O
+ * sleeps, so bios of a backed disk go through the workqueue.
+ */
+static blk_qc_t drv_make_request(struct request_queue * q, struct bio * bio)
+{
+    struct drv_blkdev * blkdev = q->queuedata;
+    unsigned long flags = 0;
+
+    if (blkdev->backing.fp) {
+        spin_lock_irqsave(&blkdev->bio_lock, flags);
+        bio_list_add(&blkdev->bios, bio);
+        spin_unlock_irqrestore(&blkdev->bio_lock, flags);
+
+        queue_work(blkdev->backing.wq, &blkdev->bio_work);
+        return BLK_QC_T_NONE;
+    }
+
+    bio->bi_error = drv_serve_bio(blkdev, bio);
+    bio_endio(bio);
+    return BLK_QC_T_NONE;
+}
+
+
+/*
+ * A request is accounted once, with every merged bio, so the stats show
+ * the sizes and latencies the block layer actually dispatches. A request
+ * that ran out of memory without being allowed to sleep is not accounted,
+ * it is served again from drv_request_work(). Writes, reads and discards
+ * are idempotent, so the retry may redo what the first attempt did.
+ */
+static int drv_serve_request(struct drv_blkdev * blkdev,
+                             struct request * rq,
+                             gfp_t gfp)
+{
+    struct drv_cmd * cmd = blk_mq_rq_to_pdu(rq);
+    u64 nbytes = blk_rq_bytes(rq);
+    struct bio * bio = NULL;
+    int status = 0;
+
+    // Flush requests of the flush machinery carry no data
+    if (rq->cmd_flags & REQ_FLUSH)
+        status = drv_flush(blkdev);
+
+    // The whole request, with every merged bio, is transferred at once
+    __rq_for_each_bio(bio, rq)
+    {
+        if (status)
+            break;
+        status = drv_handle_bio(blkdev, bio, gfp);
     }
+    if (!status && (rq->cmd_flags & REQ_FUA))
+        status = drv_flush(blkdev);
+
+    if (status == -ENOMEM && !gfpflags_allow_blocking(gfp))
+        return status;
+
+    if (nbytes)
+        drv_stats_account(&blkdev->stats,
+                          drv_stats_dir(rq->cmd_flags),
+                          nbytes,
+                          ktime_get_ns() - cmd->start,
+                          status);
+    return status;
+}
+
+
+static void drv_request_work(struct work_struct * work)
+{
+    struct drv_cmd * cmd = container_of(work, struct drv_cmd, work);
+    struct request * rq = blk_mq_rq_from_pdu(cmd);
+
+    blk_mq_end_request(rq,
+                       drv_serve_request(rq->q->queuedata, rq, GFP_NOIO));
+}
+
+
+static void drv_queue_work(struct workqueue_struct * wq, struct request * rq)
+{
+    struct drv_cmd * cmd = blk_mq_rq_to_pdu(rq);
+
+    INIT_WORK(&cmd->work, drv_request_work);
+    queue_work(wq, &cmd->work);
+}
+
+
+static int drv_queue_rq(struct blk_mq_hw_ctx * hctx,
+                        const struct blk_mq_queue_data * bd)
+{
+    struct request * rq = bd->rq;
+    struct drv_blkdev * blkdev = hctx->queue->queuedata;
+    struct drv_cmd * cmd = blk_mq_rq_to_pdu(rq);
+    int status = 0;
+
+    DRV_LOG_CTX_SET("drv_queue_rq");
+
+    cmd->start = ktime_get_ns();
+    blk_mq_start_request(rq);
+
+    if (rq->cmd_type != REQ_TYPE_FS) {
+        LG_WRN("Skip non-fs request");
+        blk_mq_end_request(rq, -EIO);
+        return BLK_MQ_RQ_QUEUE_OK;
+    }
+
+    // queue_rq() must not sleep, backing file I/O does
+    if (blkdev->backing.fp) {
+        drv_queue_work(blkdev->backing.wq, rq);
+        return BLK_MQ_RQ_QUEUE_OK;
+    }
+
+    /*
+     * Out of memory, the request is retried where storage may sleep for
+     * it. Requeueing with BLK_MQ_RQ_QUEUE_BUSY would leave the request
+     * waiting for the next dispatch, which nothing here triggers.
+     */
+    status = drv_serve_request(blkdev, rq, GFP_NOWAIT);
+    if (status == -ENOMEM) {
+        drv_queue_work(module_globals.wq, rq);
+        return BLK_MQ_RQ_QUEUE_OK;
+    }
+
+    blk_mq_end_request(rq, status);
+    return BLK_MQ_RQ_QUEUE_OK;
 }
 
 
+static struct blk_mq_ops drv_mq_ops = {
+    .queue_rq = drv_queue_rq,
+    .map_queue = blk_mq_map_queue,
+};
+
+
+static ssize_t orig_data_size_show(struct device * dev,
+                                   struct device_attribute * attr,
+                                   char * buf)
+{
+    struct drv_blkdev * blkdev = dev_to_disk(dev)->private_data;
+    u64 pages = atomic64_read(&blkdev->storage.stats.pages_stored);
+
+    return scnprintf(buf, PAGE_SIZE, "%llu\n", pages << PAGE_SHIFT);
+}
+
+
+static ssize_t compr_data_size_show(struct device * dev,
+                                    struct device_attribute * attr,
+                                    char * buf)
+{
+    struct drv_blkdev * blkdev = dev_to_disk(dev)->private_data;
+    u64 size = atomic64_read(&blkdev->storage.stats.compr_data_size);
+
+    return scnprintf(buf, PAGE_SIZE, "%llu\n", size);
+}
+
+
+static ssize_t mem_used_total_show(struct device * dev,
+                                   struct device_attribute * attr,
+                                   char * buf)
+{
+    struct drv_blkdev * blkdev = dev_to_disk(dev)->private_data;
+
+    return scnprintf(
+        buf, PAGE_SIZE, "%llu\n", drv_storage_mem_used(&blkdev->storage));
+}
+
+
+static ssize_t same_pages_show(struct device * dev,
+                               struct device_attribute * attr,
+                               char * buf)
+{
+    struct drv_blkdev * blkdev = dev_to_disk(dev)->private_data;
+    u64 pages = atomic64_read(&blkdev->storage.stats.same_pages);
+
+    return scnprintf(buf, PAGE_SIZE, "%llu\n", pages);
+}
+
+
+static DEVICE_ATTR_RO(orig_data_size);
+static DEVICE_ATTR_RO(compr_data_size);
+static DEVICE_ATTR_RO(mem_used_total);
+static DEVICE_ATTR_RO(same_pages);
+
+// Exported under /sys/block/<disk>/
+static struct attribute * drv_disk_attrs[] = {
+    &dev_attr_orig_data_size.attr,
+    &dev_attr_compr_data_size.attr,
+    &dev_attr_mem_used_total.attr,
+    &dev_attr_same_pages.attr,
+    NULL,
+};
+
+static struct attribute_group drv_disk_attr_group = {
+    .attrs = drv_disk_attrs,
+};
+
+
 static int drv_gendisk_create(struct drv_blkdev * blkdev)
 {
     DRV_LOG_CTX_SET("drv_gendisk_create");
@@ -151,20 +668,23 @@ static int drv_gendisk_create(struct drv_blkdev * blkdev)
 
     LG_DBG("Initialize gendisk");
     blkdev->gd->major = module_globals.blk_major;
-    blkdev->gd->first_minor = 0;
+    blkdev->gd->first_minor = blkdev->first_minor;
     blkdev->gd->fops = &module_globals.blk_ops;
     blkdev->gd->queue = blkdev->queue;
     blkdev->gd->private_data = blkdev;
 
-    snprintf(blkdev->gd->disk_name, DRV_DISKNAME_MAX, DRV_NAME);
+    strlcpy(blkdev->gd->disk_name, blkdev->name, DRV_DISKNAME_MAX);
 
     LG_DBG("Adding gendisk into the system");
 
     // See https://stackoverflow.com/questions/13518404/add-disk-hangs-on-insmod
     set_capacity(blkdev->gd, 0);
     add_disk(blkdev->gd);
-    set_capacity(blkdev->gd,
-                 DRV_NSECTORS * (DRV_SECTOR_SZ / KERNEL_SECTOR_SIZE));
+    set_capacity(blkdev->gd, blkdev->size / KERNEL_SECTOR_SIZE);
+
+    if (sysfs_create_group(&disk_to_dev(blkdev->gd)->kobj,
+                           &drv_disk_attr_group))
+        LG_WRN("Failed to create storage stats in sysfs");
 
     return DRV_OP_SUCCESS;
 }
@@ -172,37 +692,162 @@ static int drv_gendisk_create(struct drv_blkdev * blkdev)
 
 static void drv_gendisk_delete(struct gendisk * gd)
 {
-    if (gd)
-        del_gendisk(gd);
+    if (!gd)
+        return;
+
+    sysfs_remove_group(&disk_to_dev(gd)->kobj, &drv_disk_attr_group);
+    del_gendisk(gd);
+    put_disk(gd);
 }
 
 
-static int drv_blkdev_init(struct drv_blkdev * blkdev, int minors)
+static int drv_queue_create(struct drv_blkdev * blkdev,
+                            const struct drv_blkdev_config * cfg)
+{
+    DRV_LOG_CTX_SET("drv_queue_create");
+
+    if (blkdev->queue_mode == DRV_QUEUE_BIO) {
+        LG_DBG("Allocate bio queue");
+        blkdev->queue = blk_alloc_queue(GFP_KERNEL);
+        if (!blkdev->queue)
+            return -ENOMEM;
+
+        blk_queue_make_request(blkdev->queue, drv_make_request);
+        return DRV_OP_SUCCESS;
+    }
+
+    LG_DBG("Allocate tag set");
+    memset(&blkdev->tag_set, 0, sizeof(blkdev->tag_set));
+    blkdev->tag_set.ops = &drv_mq_ops;
+    blkdev->tag_set.nr_hw_queues = hw_queues ? hw_queues : num_online_cpus();
+    blkdev->tag_set.queue_depth = cfg->queue_depth;
+    blkdev->tag_set.numa_node = NUMA_NO_NODE;
+    blkdev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+    blkdev->tag_set.cmd_size = sizeof(struct drv_cmd);
+    blkdev->tag_set.driver_data = blkdev;
+    if (blk_mq_alloc_tag_set(&blkdev->tag_set)) {
+        LG_FAILED_TO("allocate tag set");
+        return -ENOMEM;
+    }
+
+    LG_DBG("Initialize queue");
+    blkdev->queue = blk_mq_init_queue(&blkdev->tag_set);
+    if (IS_ERR(blkdev->queue)) {
+        blk_mq_free_tag_set(&blkdev->tag_set);
+        blkdev->queue = NULL;
+        return -ENOMEM;
+    }
+
+    return DRV_OP_SUCCESS;
+}
+
+
+static void drv_queue_destroy(struct drv_blkdev * blkdev)
+{
+    blk_cleanup_queue(blkdev->queue);
+    if (blkdev->queue_mode == DRV_QUEUE_MQ)
+        blk_mq_free_tag_set(&blkdev->tag_set);
+    blkdev->queue = NULL;
+}
+
+
+static unsigned int drv_storage_flags(const struct drv_blkdev_config * cfg)
+{
+    unsigned int flags = 0;
+
+    if (compress)
+        flags |= DRV_STORAGE_COMPRESS;
+    if (dax)
+        flags |= DRV_STORAGE_PINNED;
+    if (cfg->backing_path)
+        flags |= DRV_STORAGE_TRACK_DIRTY;
+    if (numa_policy == DRV_NUMA_INTERLEAVE)
+        flags |= DRV_STORAGE_INTERLEAVE;
+    return flags;
+}
+
+
+// The caller names the disk and picks its minors
+static int drv_blkdev_init(struct drv_blkdev * blkdev,
+                           const struct drv_blkdev_config * cfg)
 {
     DRV_LOG_CTX_SET("drv_blkdev_init");
 
-    blkdev->minors = minors;
+    blkdev->size = cfg->size;
+    blkdev->block_size = cfg->block_size;
+    blkdev->queue_mode = queue_mode;
 
-    LG_DBG("Allocate memory for vdisk");
-    blkdev->size = DRV_SECTOR_SZ * DRV_NSECTORS;
-    blkdev->vdisk = vmalloc(blkdev->size);
-    if (blkdev->vdisk == NULL) {
-        LG_FAILED_TO("allocate memory for vdisk");
+    spin_lock_init(&blkdev->bio_lock);
+    bio_list_init(&blkdev->bios);
+    INIT_WORK(&blkdev->bio_work, drv_bio_work);
+
+    LG_DBG("Initialize sparse storage");
+    if (drv_storage_init(
+            &blkdev->storage, blkdev->name, drv_storage_flags(cfg))) {
+        LG_FAILED_TO("initialize storage");
         goto out;
     }
 
+    if (cfg->backing_path) {
+        LG_DBG("Open backing file");
+        if (drv_backing_open(&blkdev->backing,
+                             &blkdev->storage,
+                             cfg->backing_path,
+                             blkdev->size,
+                             blkdev->name,
+                             wb_delay_ms)) {
+            LG_FAILED_TO("open backing file");
+            goto undo_storage_init;
+        }
+    }
+
+    if (cfg->origin) {
+        struct request_queue * q = cfg->origin->queue;
+        int status = 0;
+
+        // Freezing waits out in-flight requests and bios of either mode
+        LG_DBG("Share the pages of the origin");
+        blk_mq_freeze_queue(q);
+        status = drv_storage_clone(&blkdev->storage, &cfg->origin->storage);
+        blk_mq_unfreeze_queue(q);
+
+        if (status) {
+            LG_FAILED_TO("share the pages of the origin");
+            goto undo_backing_open;
+        }
+    }
+
+    LG_DBG("Initialize stats");
+    if (drv_stats_init(&blkdev->stats, blkdev->name) < 0) {
+        LG_FAILED_TO("initialize stats");
+        goto undo_backing_open;
+    }
+
     LG_DBG("Initialize queue");
-    spin_lock_init(&blkdev->lock);
-    blkdev->queue = blk_init_queue(drv_request_handler, &blkdev->lock);
-    if (!blkdev->queue) {
+    if (drv_queue_create(blkdev, cfg) < 0) {
         LG_FAILED_TO("initialize requests queue");
-        goto undo_vdisk_alloc;
+        goto undo_stats_init;
     }
 
     LG_DBG("Setting blk logical size");
-    blk_queue_logical_block_size(blkdev->queue, DRV_SECTOR_SZ);
+    blk_queue_logical_block_size(blkdev->queue, blkdev->block_size);
+    blk_queue_physical_block_size(blkdev->queue, blkdev->block_size);
     blkdev->queue->queuedata = blkdev;
 
+    // Segments are kmapped, highmem pages need no bounce buffers
+    blk_queue_bounce_limit(blkdev->queue, BLK_BOUNCE_ANY);
+
+    LG_DBG("Enable discard and write same");
+    queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, blkdev->queue);
+    blkdev->queue->limits.discard_granularity = PAGE_SIZE;
+    blkdev->queue->limits.discard_zeroes_data = 1;
+    blk_queue_max_discard_sectors(blkdev->queue, UINT_MAX);
+    blk_queue_max_write_same_sectors(blkdev->queue, UINT_MAX);
+
+    // A flush writes dirty pages back and syncs the backing file
+    if (blkdev->backing.fp)
+        blk_queue_flush(blkdev->queue, REQ_FLUSH | REQ_FUA);
+
     LG_DBG("Create gendisk");
     if (drv_gendisk_create(blkdev) < 0) {
         LG_FAILED_TO("create gendisk");
@@ -212,11 +857,16 @@ static int drv_blkdev_init(struct drv_blkdev * blkdev, int minors)
     return DRV_OP_SUCCESS;
 
 undo_blk_queue_init:
-    blk_cleanup_queue(blkdev->queue);
-undo_vdisk_alloc:
-    vfree(blkdev->vdisk);
+    drv_queue_destroy(blkdev);
+undo_stats_init:
+    drv_stats_deinit(&blkdev->stats);
+undo_backing_open:
+    if (blkdev->backing.fp)
+        drv_backing_close(&blkdev->backing);
+undo_storage_init:
+    drv_storage_free(&blkdev->storage);
 out:
-    blkdev->vdisk = NULL;
+    blkdev->queue = NULL;
     blkdev->size = 0;
     return -ENOMEM;
 }
@@ -225,43 +875,444 @@ out:
 static void drv_blkdev_deinit(struct drv_blkdev * blkdev)
 {
     drv_gendisk_delete(blkdev->gd);
-    blk_cleanup_queue(blkdev->queue);
-    vfree(blkdev->vdisk);
+    drv_queue_destroy(blkdev);
+    // The queue is drained, the last writeback sees every write
+    if (blkdev->backing.fp)
+        drv_backing_close(&blkdev->backing);
+    drv_stats_deinit(&blkdev->stats);
+    drv_storage_free(&blkdev->storage);
 
     blkdev->gd = NULL;
     blkdev->queue = NULL;
-    blkdev->vdisk = NULL;
     blkdev->size = 0;
 }
 
 
+static int drv_config_check(const struct drv_blkdev_config * cfg)
+{
+    DRV_LOG_CTX_SET("drv_config_check");
+
+    if (!cfg->size) {
+        LG_ERR("Disk size must not be zero");
+        return -EINVAL;
+    }
+    if (cfg->block_size < KERNEL_SECTOR_SIZE || cfg->block_size > PAGE_SIZE
+        || !is_power_of_2(cfg->block_size)) {
+        LG_ERR("Block size must be a power of two from 512 to page size");
+        return -EINVAL;
+    }
+    if (!cfg->queue_depth) {
+        LG_ERR("Queue depth must not be zero");
+        return -EINVAL;
+    }
+    return DRV_OP_SUCCESS;
+}
+
+
+// Returns the id of the new disk
+static int drv_add_device(const struct drv_blkdev_config * cfg)
+{
+    struct drv_blkdev * blkdev = NULL;
+    int status = drv_config_check(cfg);
+    int id = 0;
+
+    if (status < 0)
+        return status;
+
+    mutex_lock(&module_globals.devices_lock);
+    if (!module_globals.ready) {
+        status = -EBUSY;
+        goto out;
+    }
+
+    while (id < DRV_MAX_DEVICES && module_globals.devices[id])
+        id++;
+    if (id == DRV_MAX_DEVICES) {
+        status = -ENOSPC;
+        goto out;
+    }
+
+    blkdev = kzalloc(sizeof(*blkdev), GFP_KERNEL);
+    if (!blkdev) {
+        status = -ENOMEM;
+        goto out;
+    }
+    blkdev->id = id;
+    blkdev->first_minor = id * DRV_MINORS;
+    blkdev->minors = DRV_PART_MINORS;
+    snprintf(blkdev->name, DRV_DISKNAME_MAX, DRV_NAME "%d", id);
+
+    status = drv_blkdev_init(blkdev, cfg);
+    if (status < 0) {
+        kfree(blkdev);
+        goto out;
+    }
+
+    module_globals.devices[id] = blkdev;
+    status = id;
+out:
+    mutex_unlock(&module_globals.devices_lock);
+    return status;
+}
+
+
+/*
+ * Returns the index of the new snapshot of disk id. The snapshot shares
+ * every page with its origin, either side copies a page on its first
+ * write to it.
+ */
+static int drv_add_snapshot(unsigned int id)
+{
+    struct drv_blkdev_config cfg = {0};
+    struct drv_blkdev * origin = NULL;
+    struct drv_blkdev * snap = NULL;
+    int status = 0;
+    int i = 0;
+
+    if (id >= DRV_MAX_DEVICES)
+        return -EINVAL;
+
+    mutex_lock(&module_globals.devices_lock);
+    origin = module_globals.devices[id];
+    if (!module_globals.ready || !origin) {
+        status = -ENODEV;
+        goto out;
+    }
+    // Compressed and mapped pages are not shared, backed ones not all loaded
+    if (compress || dax || origin->backing.fp) {
+        status = -EOPNOTSUPP;
+        goto out;
+    }
+
+    while (i < DRV_SNAPSHOTS && origin->snapshots[i])
+        i++;
+    if (i == DRV_SNAPSHOTS) {
+        status = -ENOSPC;
+        goto out;
+    }
+
+    snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap) {
+        status = -ENOMEM;
+        goto out;
+    }
+    snap->id = id;
+    snap->first_minor = origin->first_minor + DRV_PART_MINORS + i;
+    snap->minors = 1;
+    snprintf(snap->name, DRV_DISKNAME_MAX, DRV_NAME "%ds%d", id, i);
+
+    cfg.size = origin->size;
+    cfg.block_size = origin->block_size;
+    cfg.queue_depth = origin->tag_set.queue_depth; // unused in bio mode
+    cfg.origin = origin;
+    status = drv_blkdev_init(snap, &cfg);
+    if (status < 0) {
+        kfree(snap);
+        goto out;
+    }
+
+    origin->snapshots[i] = snap;
+    status = i;
+out:
+    mutex_unlock(&module_globals.devices_lock);
+    return status;
+}
+
+
+static bool drv_blkdev_busy(struct drv_blkdev * blkdev)
+{
+    struct block_device * bdev = bdget_disk(blkdev->gd, 0);
+    bool busy = false;
+
+    if (!bdev)
+        return false;
+
+    mutex_lock(&bdev->bd_mutex);
+    busy = bdev->bd_openers > 0;
+    mutex_unlock(&bdev->bd_mutex);
+    bdput(bdev);
+
+    return busy;
+}
+
+
+static bool drv_blkdev_has_snapshots(struct drv_blkdev * blkdev)
+{
+    int i = 0;
+
+    for (i = 0; i < DRV_SNAPSHOTS; i++) {
+        if (blkdev->snapshots[i])
+            return true;
+    }
+    return false;
+}
+
+
+static int drv_remove_snapshot(unsigned int id, unsigned int snap_id)
+{
+    struct drv_blkdev * snap = NULL;
+    int status = DRV_OP_SUCCESS;
+
+    if (id >= DRV_MAX_DEVICES || snap_id >= DRV_SNAPSHOTS)
+        return -EINVAL;
+
+    mutex_lock(&module_globals.devices_lock);
+    if (!module_globals.ready || !module_globals.devices[id]) {
+        status = -ENODEV;
+        goto out;
+    }
+    snap = module_globals.devices[id]->snapshots[snap_id];
+    if (!snap) {
+        status = -ENODEV;
+        goto out;
+    }
+    if (drv_blkdev_busy(snap)) {
+        status = -EBUSY;
+        goto out;
+    }
+
+    module_globals.devices[id]->snapshots[snap_id] = NULL;
+    drv_blkdev_deinit(snap);
+    kfree(snap);
+out:
+    mutex_unlock(&module_globals.devices_lock);
+    return status;
+}
+
+
+static int drv_remove_device(unsigned int id)
+{
+    struct drv_blkdev * blkdev = NULL;
+    int status = DRV_OP_SUCCESS;
+
+    if (id >= DRV_MAX_DEVICES)
+        return -EINVAL;
+
+    mutex_lock(&module_globals.devices_lock);
+    blkdev = module_globals.devices[id];
+    if (!module_globals.ready || !blkdev) {
+        status = -ENODEV;
+        goto out;
+    }
+    // Snapshot minors belong to the range of the disk
+    if (drv_blkdev_busy(blkdev) || drv_blkdev_has_snapshots(blkdev)) {
+        status = -EBUSY;
+        goto out;
+    }
+
+    module_globals.devices[id] = NULL;
+    drv_blkdev_deinit(blkdev);
+    kfree(blkdev);
+out:
+    mutex_unlock(&module_globals.devices_lock);
+    return status;
+}
+
+
+static void drv_remove_all_devices(void)
+{
+    int id = 0;
+    int i = 0;
+
+    mutex_lock(&module_globals.devices_lock);
+    module_globals.ready = false;
+    for (id = 0; id < DRV_MAX_DEVICES; id++) {
+        if (!module_globals.devices[id])
+            continue;
+
+        for (i = 0; i < DRV_SNAPSHOTS; i++) {
+            struct drv_blkdev * snap = module_globals.devices[id]->snapshots[i];
+
+            if (!snap)
+                continue;
+            drv_blkdev_deinit(snap);
+            kfree(snap);
+        }
+
+        drv_blkdev_deinit(module_globals.devices[id]);
+        kfree(module_globals.devices[id]);
+        module_globals.devices[id] = NULL;
+    }
+    mutex_unlock(&module_globals.devices_lock);
+}
+
+
+/*
+ * Runtime control through /sys/module/<module>/parameters/:
+ *   echo "size_mb [block_size [queue_depth]]" > add_device
+ *   echo <id> > remove_device
+ *   echo <id> > add_snapshot
+ *   echo "<id> <snapshot>" > remove_snapshot
+ */
+static int drv_add_device_set(const char * val, const struct kernel_param * kp)
+{
+    struct drv_blkdev_config cfg = {.block_size = DRV_SECTOR_SZ,
+                                    .queue_depth = DRV_QUEUE_DEPTH};
+    unsigned long size_mb = 0;
+    int status = 0;
+
+    if (sscanf(val, "%lu %u %u", &size_mb, &cfg.block_size, &cfg.queue_depth)
+        < 1)
+        return -EINVAL;
+    cfg.size = (u64)size_mb << 20;
+
+    status = drv_add_device(&cfg);
+    return status < 0 ? status : 0;
+}
+
+
+static int drv_remove_device_set(const char * val,
+                                 const struct kernel_param * kp)
+{
+    unsigned int id = 0;
+    int status = kstrtouint(val, 10, &id);
+
+    return status < 0 ? status : drv_remove_device(id);
+}
+
+
+static int drv_add_snapshot_set(const char * val,
+                                const struct kernel_param * kp)
+{
+    unsigned int id = 0;
+    int status = kstrtouint(val, 10, &id);
+
+    if (status < 0)
+        return status;
+
+    status = drv_add_snapshot(id);
+    return status < 0 ? status : 0;
+}
+
+
+static int drv_remove_snapshot_set(const char * val,
+                                   const struct kernel_param * kp)
+{
+    unsigned int id = 0;
+    unsigned int snap_id = 0;
+
+    if (sscanf(val, "%u %u", &id, &snap_id) != 2)
+        return -EINVAL;
+
+    return drv_remove_snapshot(id, snap_id);
+}
+
+
+static const struct kernel_param_ops drv_add_device_ops = {
+    .set = drv_add_device_set,
+};
+
+static const struct kernel_param_ops drv_remove_device_ops = {
+    .set = drv_remove_device_set,
+};
+
+static const struct kernel_param_ops drv_add_snapshot_ops = {
+    .set = drv_add_snapshot_set,
+};
+
+static const struct kernel_param_ops drv_remove_snapshot_ops = {
+    .set = drv_remove_snapshot_set,
+};
+
+module_param_cb(add_device, &drv_add_device_ops, NULL, 0200);
+MODULE_PARM_DESC(add_device, "Add a disk: \"size_mb [block_size [depth]]\"");
+module_param_cb(remove_device, &drv_remove_device_ops, NULL, 0200);
+MODULE_PARM_DESC(remove_device, "Remove the disk with the given id");
+module_param_cb(add_snapshot, &drv_add_snapshot_ops, NULL, 0200);
+MODULE_PARM_DESC(add_snapshot, "Snapshot the disk with the given id");
+module_param_cb(remove_snapshot, &drv_remove_snapshot_ops, NULL, 0200);
+MODULE_PARM_DESC(remove_snapshot, "Remove a snapshot: \"<id> <snapshot>\"");
+
+
 static int __init drv_init(void)
 {
     int status = 0;
+    unsigned int i = 0;
     DRV_LOG_CTX_SET("drv_init");
     LG_INF("Start module initialization");
 
+    if (queue_mode > DRV_QUEUE_MQ) {
+        LG_ERR("Unknown queue_mode");
+        return -EINVAL;
+    }
+    if (numa_policy > DRV_NUMA_INTERLEAVE) {
+        LG_ERR("Unknown numa_policy");
+        return -EINVAL;
+    }
+    if (dax && compress) {
+        LG_ERR("dax and compress are mutually exclusive");
+        return -EINVAL;
+    }
+    if (dax && nr_backing_file) {
+        LG_ERR("dax and backing_file are mutually exclusive");
+        return -EINVAL;
+    }
+    if (dax)
+        module_globals.blk_ops.direct_access = drv_direct_access;
+
+    LG_DBG("Create storage caches");
+    status = drv_storage_module_init();
+    if (status < 0) {
+        LG_FAILED_TO("create storage caches");
+        goto out;
+    }
+
+    drv_stats_module_init();
+
     LG_DBG("Register blkdev");
     module_globals.blk_major
         = register_blkdev(module_globals.blk_major, DRV_NAME);
     if (module_globals.blk_major <= 0) {
         LG_FAILED_TO("register blkdev");
         status = module_globals.blk_major;
-        goto out;
+        goto undo_stats_module_init;
     }
 
-    LG_DBG("Initialize blkdev");
-    status = drv_blkdev_init(&module_globals.blkdev, DRV_MINORS);
-    if (status < 0) {
-        LG_FAILED_TO("initialize blkdev");
-        goto undo_blkdev_reg;
+    LG_DBG("Create retry workqueue");
+    module_globals.wq = alloc_workqueue(DRV_NAME, WQ_MEM_RECLAIM, 0);
+    if (!module_globals.wq) {
+        LG_FAILED_TO("create retry workqueue");
+        status = -ENOMEM;
+        goto undo_blkdev_register;
+    }
+
+    mutex_lock(&module_globals.devices_lock);
+    module_globals.ready = true;
+    mutex_unlock(&module_globals.devices_lock);
+
+    LG_DBG("Initialize blkdevs");
+    for (i = 0; i < min_t(unsigned int, nr_devices, DRV_MAX_DEVICES); i++) {
+        struct drv_blkdev_config cfg = {
+            .size = (u64)DRV_PARAM_AT(disk_mb, nr_disk_mb, i, DRV_DISK_MB)
+                    << 20,
+            .block_size
+            = DRV_PARAM_AT(block_size, nr_block_size, i, DRV_SECTOR_SZ),
+            .queue_depth
+            = DRV_PARAM_AT(queue_depth, nr_queue_depth, i, DRV_QUEUE_DEPTH),
+            .backing_path = i < nr_backing_file && backing_file[i]
+                                    && *backing_file[i]
+                                ? backing_file[i]
+                                : NULL,
+        };
+
+        status = drv_add_device(&cfg);
+        if (status < 0) {
+            LG_FAILED_TO("initialize blkdev");
+            goto undo_devices_add;
+        }
     }
 
     LG_INF("Module successfully initialized");
     return DRV_OP_SUCCESS;
 
-undo_blkdev_reg:
+undo_devices_add:
+    drv_remove_all_devices();
+    destroy_workqueue(module_globals.wq);
+undo_blkdev_register:
     unregister_blkdev(module_globals.blk_major, DRV_NAME);
+undo_stats_module_init:
+    drv_stats_module_exit();
+    drv_storage_module_exit();
 out:
     return status;
 }
@@ -270,8 +1321,11 @@ out:
 static void __exit drv_exit(void)
 {
     DRV_LOG_CTX_SET("drv_exit");
-    drv_blkdev_deinit(&module_globals.blkdev);
+    drv_remove_all_devices();
+    destroy_workqueue(module_globals.wq);
     unregister_blkdev(module_globals.blk_major, DRV_NAME);
+    drv_stats_module_exit();
+    drv_storage_module_exit();
     LG_DBG("Module was removed");
 }
 
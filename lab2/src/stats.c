@@ -0,0 +1,180 @@
+#include <linux/bitops.h>
+#include <linux/seq_file.h>
+
+#include "logging.h"
+#include "stats.h"
+
+
+static struct dentry * stats_root = NULL;
+
+static const char * const dir_names[DRV_STATS_DIRS] = {
+    [DRV_STATS_READ] = "read",
+    [DRV_STATS_WRITE] = "write",
+    [DRV_STATS_DISCARD] = "discard",
+};
+
+
+// debugfs is optional, the counters work without it
+void drv_stats_module_init(void)
+{
+    stats_root = debugfs_create_dir(DRV_NAME, NULL);
+    if (IS_ERR(stats_root))
+        stats_root = NULL;
+}
+
+
+void drv_stats_module_exit(void)
+{
+    debugfs_remove_recursive(stats_root);
+    stats_root = NULL;
+}
+
+
+static unsigned int drv_stats_bucket(u64 value)
+{
+    return min_t(unsigned int, fls64(value), DRV_STATS_BUCKETS - 1);
+}
+
+
+void drv_stats_account(struct drv_stats * stats,
+                       enum drv_stats_dir dir,
+                       u64 bytes,
+                       u64 ns,
+                       int error)
+{
+    this_cpu_inc(stats->cpu->ops[dir]);
+    this_cpu_add(stats->cpu->bytes[dir], bytes);
+    this_cpu_inc(stats->cpu->size_hist[drv_stats_bucket(bytes)]);
+    this_cpu_inc(stats->cpu->latency_hist[drv_stats_bucket(ns)]);
+    if (error)
+        this_cpu_inc(stats->cpu->errors);
+}
+
+
+// Sums the counters of all CPUs, values may be slightly out of sync
+static void drv_stats_sum(struct drv_stats * stats, struct drv_cpu_stats * sum)
+{
+    int cpu = 0;
+    int i = 0;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu)
+    {
+        struct drv_cpu_stats * s = per_cpu_ptr(stats->cpu, cpu);
+
+        for (i = 0; i < DRV_STATS_DIRS; i++) {
+            sum->ops[i] += s->ops[i];
+            sum->bytes[i] += s->bytes[i];
+        }
+        for (i = 0; i < DRV_STATS_BUCKETS; i++) {
+            sum->size_hist[i] += s->size_hist[i];
+            sum->latency_hist[i] += s->latency_hist[i];
+        }
+        sum->errors += s->errors;
+    }
+}
+
+
+static void drv_stats_show_hist(struct seq_file * m, const u64 * hist)
+{
+    int i = 0;
+
+    for (i = 0; i < DRV_STATS_BUCKETS; i++) {
+        if (!hist[i])
+            continue;
+
+        seq_printf(m,
+                   "[%llu, %llu) %llu\n",
+                   i ? 1ULL << (i - 1) : 0,
+                   1ULL << i,
+                   hist[i]);
+    }
+}
+
+
+static int drv_stats_io_show(struct seq_file * m, void * v)
+{
+    struct drv_cpu_stats sum;
+    int i = 0;
+
+    drv_stats_sum(m->private, &sum);
+    for (i = 0; i < DRV_STATS_DIRS; i++) {
+        seq_printf(m, "%s_ops %llu\n", dir_names[i], sum.ops[i]);
+        seq_printf(m, "%s_bytes %llu\n", dir_names[i], sum.bytes[i]);
+    }
+    seq_printf(m, "errors %llu\n", sum.errors);
+    return 0;
+}
+
+
+static int drv_stats_size_show(struct seq_file * m, void * v)
+{
+    struct drv_cpu_stats sum;
+
+    drv_stats_sum(m->private, &sum);
+    drv_stats_show_hist(m, sum.size_hist);
+    return 0;
+}
+
+
+static int drv_stats_latency_show(struct seq_file * m, void * v)
+{
+    struct drv_cpu_stats sum;
+
+    drv_stats_sum(m->private, &sum);
+    drv_stats_show_hist(m, sum.latency_hist);
+    return 0;
+}
+
+
+#define DRV_STATS_FOPS(name)                                         \
+    static int drv_stats_##name##_open(struct inode * inode,         \
+                                       struct file * file)           \
+    {                                                                \
+        return single_open(file, drv_stats_##name##_show,            \
+                           inode->i_private);                        \
+    }                                                                \
+                                                                     \
+    static const struct file_operations drv_stats_##name##_fops = {  \
+        .owner = THIS_MODULE,                                        \
+        .open = drv_stats_##name##_open,                             \
+        .read = seq_read,                                            \
+        .llseek = seq_lseek,                                         \
+        .release = single_release,                                   \
+    };
+
+DRV_STATS_FOPS(io)
+DRV_STATS_FOPS(size)
+DRV_STATS_FOPS(latency)
+
+
+int drv_stats_init(struct drv_stats * stats, const char * name)
+{
+    stats->dir = NULL;
+    stats->cpu = alloc_percpu(struct drv_cpu_stats);
+    if (!stats->cpu)
+        return -ENOMEM;
+
+    if (!stats_root)
+        return 0;
+
+    stats->dir = debugfs_create_dir(name, stats_root);
+    if (!stats->dir)
+        return 0;
+
+    debugfs_create_file("io", 0444, stats->dir, stats, &drv_stats_io_fops);
+    debugfs_create_file(
+        "size_hist", 0444, stats->dir, stats, &drv_stats_size_fops);
+    debugfs_create_file(
+        "latency_hist", 0444, stats->dir, stats, &drv_stats_latency_fops);
+    return 0;
+}
+
+
+void drv_stats_deinit(struct drv_stats * stats)
+{
+    debugfs_remove_recursive(stats->dir);
+    stats->dir = NULL;
+    free_percpu(stats->cpu);
+    stats->cpu = NULL;
+}
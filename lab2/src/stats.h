@@ -0,0 +1,53 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <linux/debugfs.h>
+#include <linux/percpu.h>
+#include <linux/types.h>
+
+
+// Bucket b of a log2 histogram counts values in [2^(b-1), 2^b)
+#define DRV_STATS_BUCKETS 40
+
+enum drv_stats_dir
+{
+    DRV_STATS_READ,
+    DRV_STATS_WRITE,
+    DRV_STATS_DISCARD,
+    DRV_STATS_DIRS
+};
+
+struct drv_cpu_stats
+{
+    u64 ops[DRV_STATS_DIRS];
+    u64 bytes[DRV_STATS_DIRS];
+    u64 errors;
+    u64 size_hist[DRV_STATS_BUCKETS]; // bytes per request
+    u64 latency_hist[DRV_STATS_BUCKETS]; // nanoseconds per request
+};
+
+/*
+ * I/O statistics of a disk. Counters are per CPU and updated without
+ * locks, readers of the debugfs files get the sum over all CPUs.
+ */
+struct drv_stats
+{
+    struct drv_cpu_stats __percpu * cpu;
+    struct dentry * dir;
+};
+
+
+void drv_stats_module_init(void);
+void drv_stats_module_exit(void);
+
+int drv_stats_init(struct drv_stats * stats, const char * name);
+void drv_stats_deinit(struct drv_stats * stats);
+
+void drv_stats_account(struct drv_stats * stats,
+                       enum drv_stats_dir dir,
+                       u64 bytes,
+                       u64 ns,
+                       int error);
+
+
+#endif
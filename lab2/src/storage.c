@@ -0,0 +1,1044 @@
+#include <linux/bug.h>
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/lz4.h>
+#include <linux/mm.h>
+#include <linux/nodemask.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/zsmalloc.h>
+
+#include "storage.h"
+
+
+/*
+ * Allocations under the slot lock must not sleep. When they fail and the
+ * caller may block, the page is retried with the slot, the page and the
+ * radix tree nodes allocated ahead of the lock.
+ */
+#define DRV_STORAGE_GFP (GFP_NOWAIT | __GFP_NOWARN)
+
+#define DRV_FREE_BATCH 16
+
+/*
+ * Pages compressed above this size save too little to pay for the
+ * decompression on every read and are stored raw.
+ */
+#define DRV_MAX_ZPAGE_SIZE (PAGE_SIZE / 4 * 3)
+
+#define DRV_SLOT_RAW 0x1 // slot holds a reference to a page
+#define DRV_SLOT_ZS 0x2 // slot owns a zsmalloc object
+#define DRV_SLOT_SAME 0x4 // page is one word repeated, nothing is allocated
+
+// Radix tree tag of slots changed since they were last written back
+#define DRV_TAG_DIRTY 0
+
+/*
+ * Content of one page of the device. An empty slot (no flags) reads as
+ * zeros. Slots are guarded by the storage lock their index hashes to.
+ * Raw pages may be shared with clones, the page refcount tells.
+ */
+struct drv_slot
+{
+    unsigned long index;
+    union
+    {
+        struct page * page;
+        unsigned long handle;
+        unsigned long element;
+    };
+    unsigned int size; // bytes held for the page
+    unsigned int flags;
+};
+
+/*
+ * Per-CPU LZ4 scratch. A stream is used only under a slot lock, which
+ * keeps the task on its CPU for the whole operation.
+ */
+struct drv_comp_stream
+{
+    void * wrkmem;
+    unsigned char * buffer; // compressed output
+    char * page; // uncompressed page for partial reads and writes
+};
+
+/*
+ * Memory taken by the retry of a page update before the slot lock, used
+ * in place of the non-blocking allocations.
+ */
+struct drv_prealloc
+{
+    struct drv_slot * slot;
+    struct page * page;
+};
+
+static struct kmem_cache * slot_cache = NULL;
+
+
+int drv_storage_module_init(void)
+{
+    slot_cache = KMEM_CACHE(drv_slot, 0);
+    return slot_cache ? 0 : -ENOMEM;
+}
+
+
+void drv_storage_module_exit(void)
+{
+    kmem_cache_destroy(slot_cache);
+    slot_cache = NULL;
+}
+
+
+static void drv_streams_free(struct drv_comp_stream __percpu * streams)
+{
+    int cpu = 0;
+
+    if (!streams)
+        return;
+
+    for_each_possible_cpu(cpu)
+    {
+        struct drv_comp_stream * zs = per_cpu_ptr(streams, cpu);
+        kfree(zs->wrkmem);
+        kfree(zs->buffer);
+        kfree(zs->page);
+    }
+    free_percpu(streams);
+}
+
+
+static struct drv_comp_stream __percpu * drv_streams_alloc(void)
+{
+    struct drv_comp_stream __percpu * streams = NULL;
+    int cpu = 0;
+
+    streams = alloc_percpu(struct drv_comp_stream);
+    if (!streams)
+        return NULL;
+
+    for_each_possible_cpu(cpu)
+    {
+        struct drv_comp_stream * zs = per_cpu_ptr(streams, cpu);
+        zs->wrkmem = kmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+        zs->buffer = kmalloc(lz4_compressbound(PAGE_SIZE), GFP_KERNEL);
+        zs->page = kmalloc(PAGE_SIZE, GFP_KERNEL);
+
+        if (!zs->wrkmem || !zs->buffer || !zs->page) {
+            drv_streams_free(streams);
+            return NULL;
+        }
+    }
+    return streams;
+}
+
+
+// Snapshot of the online nodes, later hotplug is not followed
+static int drv_nodes_init(struct drv_storage * st)
+{
+    int nid = 0;
+
+    st->nr_nodes = 0;
+    st->nodes = kmalloc_array(num_online_nodes(), sizeof(int), GFP_KERNEL);
+    if (!st->nodes)
+        return -ENOMEM;
+
+    for_each_online_node(nid)
+    {
+        if (st->nr_nodes == num_online_nodes())
+            break;
+        st->nodes[st->nr_nodes++] = nid;
+    }
+    return 0;
+}
+
+
+int drv_storage_init(struct drv_storage * st,
+                     const char * name,
+                     unsigned int flags)
+{
+    int i = 0;
+
+    INIT_RADIX_TREE(&st->slots, DRV_STORAGE_GFP);
+    spin_lock_init(&st->tree_lock);
+    for (i = 0; i < DRV_STORAGE_LOCKS; i++)
+        spin_lock_init(&st->locks[i]);
+
+    atomic64_set(&st->stats.pages_stored, 0);
+    atomic64_set(&st->stats.raw_pages, 0);
+    atomic64_set(&st->stats.compr_data_size, 0);
+    atomic64_set(&st->stats.same_pages, 0);
+
+    st->flags = flags;
+    st->pool = NULL;
+    st->streams = NULL;
+    st->nodes = NULL;
+    st->nr_nodes = 0;
+
+    // Compressed objects move and can not be mapped
+    if ((flags & DRV_STORAGE_COMPRESS) && (flags & DRV_STORAGE_PINNED))
+        return -EINVAL;
+
+    if ((flags & DRV_STORAGE_INTERLEAVE) && drv_nodes_init(st))
+        return -ENOMEM;
+
+    if (!(flags & DRV_STORAGE_COMPRESS))
+        return 0;
+
+    st->pool = zs_create_pool(name, DRV_STORAGE_GFP | __GFP_HIGHMEM);
+    if (!st->pool)
+        goto undo_nodes_init;
+
+    st->streams = drv_streams_alloc();
+    if (!st->streams)
+        goto undo_pool_create;
+    return 0;
+
+undo_pool_create:
+    zs_destroy_pool(st->pool);
+    st->pool = NULL;
+undo_nodes_init:
+    kfree(st->nodes);
+    st->nodes = NULL;
+    return -ENOMEM;
+}
+
+
+static spinlock_t * drv_slot_lock(struct drv_storage * st, pgoff_t idx)
+{
+    return &st->locks[idx & (DRV_STORAGE_LOCKS - 1)];
+}
+
+
+static struct drv_slot * drv_slot_lookup(struct drv_storage * st, pgoff_t idx)
+{
+    struct drv_slot * slot = NULL;
+
+    rcu_read_lock();
+    slot = radix_tree_lookup(&st->slots, idx);
+    rcu_read_unlock();
+
+    return slot;
+}
+
+
+// Must be called with the slot lock held
+static struct drv_slot * drv_slot_get(struct drv_storage * st,
+                                      pgoff_t idx,
+                                      struct drv_prealloc * pre)
+{
+    struct drv_slot * slot = drv_slot_lookup(st, idx);
+    int status = 0;
+
+    if (slot)
+        return slot;
+
+    if (pre->slot) {
+        slot = pre->slot;
+        pre->slot = NULL;
+    } else {
+        slot = kmem_cache_zalloc(slot_cache, DRV_STORAGE_GFP);
+        if (!slot)
+            return NULL;
+    }
+    slot->index = idx;
+
+    spin_lock(&st->tree_lock);
+    status = radix_tree_insert(&st->slots, idx, slot);
+    spin_unlock(&st->tree_lock);
+
+    if (status) {
+        pre->slot = slot;
+        return NULL;
+    }
+    return slot;
+}
+
+
+// Releases whatever the slot holds, leaving it empty
+static void drv_slot_clear(struct drv_storage * st, struct drv_slot * slot)
+{
+    // A shared page is freed with its last reference
+    if (slot->flags & DRV_SLOT_RAW) {
+        __free_page(slot->page);
+        atomic64_dec(&st->stats.raw_pages);
+    } else if (slot->flags & DRV_SLOT_ZS) {
+        zs_free(st->pool, slot->handle);
+        atomic64_sub(slot->size, &st->stats.compr_data_size);
+    } else if (slot->flags & DRV_SLOT_SAME) {
+        atomic64_dec(&st->stats.same_pages);
+    }
+
+    if (slot->flags)
+        atomic64_dec(&st->stats.pages_stored);
+
+    slot->handle = 0;
+    slot->size = 0;
+    slot->flags = 0;
+}
+
+
+static void drv_slot_remove(struct drv_storage * st, struct drv_slot * slot)
+{
+    spin_lock(&st->tree_lock);
+    radix_tree_delete(&st->slots, slot->index);
+    spin_unlock(&st->tree_lock);
+
+    drv_slot_clear(st, slot);
+    kmem_cache_free(slot_cache, slot);
+}
+
+
+/*
+ * Drops every page with an index in [start, end). Holes are skipped by
+ * the gang lookup, so sparse ranges cost only what is populated.
+ */
+static void drv_storage_remove(struct drv_storage * st,
+                               pgoff_t start,
+                               pgoff_t end)
+{
+    void ** results[DRV_FREE_BATCH];
+    unsigned long indices[DRV_FREE_BATCH];
+    int nr_slots = 0;
+    int i = 0;
+
+    do {
+        rcu_read_lock();
+        nr_slots = radix_tree_gang_lookup_slot(
+            &st->slots, results, indices, start, DRV_FREE_BATCH);
+        rcu_read_unlock();
+
+        for (i = 0; i < nr_slots && indices[i] < end; i++) {
+            spinlock_t * lock = drv_slot_lock(st, indices[i]);
+            struct drv_slot * slot = NULL;
+
+            spin_lock(lock);
+            slot = drv_slot_lookup(st, indices[i]);
+            if (slot)
+                drv_slot_remove(st, slot);
+            spin_unlock(lock);
+        }
+
+        if (i)
+            start = indices[i - 1] + 1;
+    } while (i == DRV_FREE_BATCH);
+}
+
+
+void drv_storage_free(struct drv_storage * st)
+{
+    drv_storage_remove(st, 0, ULONG_MAX);
+
+    drv_streams_free(st->streams);
+    st->streams = NULL;
+    if (st->pool)
+        zs_destroy_pool(st->pool);
+    st->pool = NULL;
+    kfree(st->nodes);
+    st->nodes = NULL;
+}
+
+
+u64 drv_storage_mem_used(struct drv_storage * st)
+{
+    u64 pages = atomic64_read(&st->stats.raw_pages);
+
+    if (st->pool)
+        pages += zs_get_total_pages(st->pool);
+    return pages << PAGE_SHIFT;
+}
+
+
+static int drv_slot_decompress(struct drv_storage * st,
+                               struct drv_slot * slot,
+                               size_t off,
+                               char * buf,
+                               size_t len)
+{
+    char * dst = len == PAGE_SIZE ? buf : this_cpu_ptr(st->streams)->page;
+    size_t dst_len = PAGE_SIZE;
+    unsigned char * src = NULL;
+    int status = 0;
+
+    src = zs_map_object(st->pool, slot->handle, ZS_MM_RO);
+    status = lz4_decompress_unknownoutputsize(
+        src, slot->size, (unsigned char *)dst, &dst_len);
+    zs_unmap_object(st->pool, slot->handle);
+
+    if (status || dst_len != PAGE_SIZE)
+        return -EIO;
+
+    if (dst != buf)
+        memcpy(buf, dst + off, len);
+    return 0;
+}
+
+
+static bool drv_page_same_filled(const char * ptr, unsigned long * element)
+{
+    const unsigned long * page = (const unsigned long *)ptr;
+    const unsigned int last = PAGE_SIZE / sizeof(*page) - 1;
+    unsigned long val = page[0];
+    unsigned int pos = 0;
+
+    // Most pages that are not same-filled already differ at the ends
+    if (val != page[last])
+        return false;
+
+    for (pos = 1; pos < last; pos++) {
+        if (page[pos] != val)
+            return false;
+    }
+
+    *element = val;
+    return true;
+}
+
+
+// Offsets and lengths are sector multiples, hence word aligned
+static void drv_page_fill(char * ptr, unsigned long element, size_t len)
+{
+    unsigned long * words = (unsigned long *)ptr;
+    size_t i = 0;
+
+    if (!element) {
+        memset(ptr, 0, len);
+        return;
+    }
+
+    for (i = 0; i < len / sizeof(*words); i++)
+        words[i] = element;
+}
+
+
+static bool drv_slot_is_zero(struct drv_slot * slot)
+{
+    return !slot->flags || ((slot->flags & DRV_SLOT_SAME) && !slot->element);
+}
+
+
+static void drv_slot_store_same(struct drv_storage * st,
+                                struct drv_slot * slot,
+                                unsigned long element)
+{
+    drv_slot_clear(st, slot);
+    slot->element = element;
+    slot->flags = DRV_SLOT_SAME;
+    atomic64_inc(&st->stats.same_pages);
+    atomic64_inc(&st->stats.pages_stored);
+}
+
+
+// Copies [off, off + len) of the page held by the slot into buf
+static int drv_slot_load(struct drv_storage * st,
+                         struct drv_slot * slot,
+                         size_t off,
+                         char * buf,
+                         size_t len)
+{
+    char * src = NULL;
+
+    if (!slot || !slot->flags) {
+        memset(buf, 0, len);
+        return 0;
+    }
+
+    if (slot->flags & DRV_SLOT_SAME) {
+        drv_page_fill(buf, slot->element, len);
+        return 0;
+    }
+
+    if (slot->flags & DRV_SLOT_ZS)
+        return drv_slot_decompress(st, slot, off, buf, len);
+
+    src = kmap_atomic(slot->page);
+    memcpy(buf, src + off, len);
+    kunmap_atomic(src);
+    return 0;
+}
+
+
+/*
+ * Without interleaving the page comes from the node of the current CPU,
+ * which the memcpy of the write and of most later reads run on.
+ */
+static struct page * drv_page_alloc(struct drv_storage * st,
+                                    pgoff_t idx,
+                                    gfp_t gfp)
+{
+    // Pinned pages are accessed through page_address()
+    if (!(st->flags & DRV_STORAGE_PINNED))
+        gfp |= __GFP_HIGHMEM;
+
+    if (st->nodes)
+        return alloc_pages_node(st->nodes[idx % st->nr_nodes], gfp, 0);
+    return alloc_page(gfp);
+}
+
+
+/*
+ * Whether the raw page of the slot is also referenced by a clone. Once
+ * the count drops to one no other storage can take a new reference, the
+ * page may then be written in place. Pinned storage is never cloned, and
+ * its pages are mapped through DAX: their count also rises with
+ * get_user_pages(), and a copy would leave the mapping on a freed page.
+ */
+static bool drv_slot_shared(struct drv_storage * st, struct drv_slot * slot)
+{
+    if (st->flags & DRV_STORAGE_PINNED)
+        return false;
+    return (slot->flags & DRV_SLOT_RAW) && page_count(slot->page) > 1;
+}
+
+
+/*
+ * Writes buf (zeros when NULL) into [off, off + len) of the raw page of
+ * the slot, switching the slot to a private raw page first if needed. On
+ * a partial write the new page starts out with the previous content of
+ * the slot.
+ */
+static int drv_slot_store_raw(struct drv_storage * st,
+                              struct drv_slot * slot,
+                              size_t off,
+                              const char * buf,
+                              size_t len,
+                              struct drv_prealloc * pre)
+{
+    char * dst = NULL;
+
+    if (!(slot->flags & DRV_SLOT_RAW) || drv_slot_shared(st, slot)) {
+        struct page * page = pre->page;
+        int status = 0;
+
+        pre->page = NULL;
+        if (!page)
+            page = drv_page_alloc(st, slot->index, DRV_STORAGE_GFP);
+        if (!page)
+            return -ENOMEM;
+
+        if (len != PAGE_SIZE) {
+            dst = kmap_atomic(page);
+            status = drv_slot_load(st, slot, 0, dst, PAGE_SIZE);
+            kunmap_atomic(dst);
+        }
+        if (status) {
+            __free_page(page);
+            return status;
+        }
+
+        drv_slot_clear(st, slot);
+        slot->page = page;
+        slot->size = PAGE_SIZE;
+        slot->flags = DRV_SLOT_RAW;
+        atomic64_inc(&st->stats.raw_pages);
+        atomic64_inc(&st->stats.pages_stored);
+    }
+
+    dst = kmap_atomic(slot->page);
+    if (buf)
+        memcpy(dst + off, buf, len);
+    else
+        memset(dst + off, 0, len);
+    kunmap_atomic(dst);
+    return 0;
+}
+
+
+/*
+ * Replaces the slot content with the compressed full page src. zsmalloc
+ * can not use memory taken ahead of the lock, so when it fails the page
+ * is stored raw instead.
+ */
+static int drv_slot_compress(struct drv_storage * st,
+                             struct drv_slot * slot,
+                             const char * src,
+                             struct drv_prealloc * pre)
+{
+    struct drv_comp_stream * zs = this_cpu_ptr(st->streams);
+    unsigned long handle = 0;
+    size_t clen = 0;
+    char * dst = NULL;
+
+    if (lz4_compress((const unsigned char *)src,
+                     PAGE_SIZE,
+                     zs->buffer,
+                     &clen,
+                     zs->wrkmem)
+        || clen > DRV_MAX_ZPAGE_SIZE)
+        return drv_slot_store_raw(st, slot, 0, src, PAGE_SIZE, pre);
+
+    handle = zs_malloc(st->pool, clen);
+    if (!handle)
+        return drv_slot_store_raw(st, slot, 0, src, PAGE_SIZE, pre);
+
+    dst = zs_map_object(st->pool, handle, ZS_MM_WO);
+    memcpy(dst, zs->buffer, clen);
+    zs_unmap_object(st->pool, handle);
+
+    drv_slot_clear(st, slot);
+    slot->handle = handle;
+    slot->size = clen;
+    slot->flags = DRV_SLOT_ZS;
+    atomic64_add(clen, &st->stats.compr_data_size);
+    atomic64_inc(&st->stats.pages_stored);
+    return 0;
+}
+
+
+/*
+ * Updates [off, off + len) of the slot with buf, or with zeros when buf is
+ * NULL. A compressed page is always rewritten as a whole, partial updates
+ * go through a read-modify-write of the per-CPU page. Must be called with
+ * the slot lock held.
+ */
+static int drv_slot_update(struct drv_storage * st,
+                           struct drv_slot * slot,
+                           size_t off,
+                           const char * buf,
+                           size_t len,
+                           struct drv_prealloc * pre)
+{
+    unsigned long element = 0;
+    char * page = NULL;
+    int status = 0;
+
+    if (st->flags & DRV_STORAGE_PINNED)
+        return drv_slot_store_raw(st, slot, off, buf, len, pre);
+
+    if (buf && len == PAGE_SIZE && drv_page_same_filled(buf, &element)) {
+        drv_slot_store_same(st, slot, element);
+        return 0;
+    }
+
+    if (!st->pool)
+        return drv_slot_store_raw(st, slot, off, buf, len, pre);
+
+    if (len != PAGE_SIZE) {
+        page = this_cpu_ptr(st->streams)->page;
+        status = drv_slot_load(st, slot, 0, page, PAGE_SIZE);
+        if (status)
+            return status;
+
+        if (buf)
+            memcpy(page + off, buf, len);
+        else
+            memset(page + off, 0, len);
+        buf = page;
+
+        if (drv_page_same_filled(buf, &element)) {
+            drv_slot_store_same(st, slot, element);
+            return 0;
+        }
+    }
+    return drv_slot_compress(st, slot, buf, pre);
+}
+
+
+static void drv_slot_mark_dirty(struct drv_storage * st,
+                                struct drv_slot * slot)
+{
+    if (!(st->flags & DRV_STORAGE_TRACK_DIRTY))
+        return;
+
+    spin_lock(&st->tree_lock);
+    radix_tree_tag_set(&st->slots, slot->index, DRV_TAG_DIRTY);
+    spin_unlock(&st->tree_lock);
+}
+
+
+/*
+ * Takes what an update of page idx may allocate under the slot lock, and
+ * preloads the radix tree. On success the caller runs the update and
+ * ends the preload.
+ */
+static int drv_prealloc_fill(struct drv_storage * st,
+                             struct drv_prealloc * pre,
+                             pgoff_t idx,
+                             gfp_t gfp)
+{
+    if (!pre->slot)
+        pre->slot = kmem_cache_zalloc(slot_cache, gfp);
+    if (!pre->page)
+        pre->page = drv_page_alloc(st, idx, gfp);
+    if (!pre->slot || !pre->page)
+        return -ENOMEM;
+
+    return radix_tree_preload(gfp);
+}
+
+
+static void drv_prealloc_free(struct drv_prealloc * pre)
+{
+    if (pre->slot)
+        kmem_cache_free(slot_cache, pre->slot);
+    if (pre->page)
+        __free_page(pre->page);
+}
+
+
+/*
+ * Updates [off, off + len) of page idx with buf, or with zeros when buf
+ * is NULL. A missing slot already reads as zeros, except on tracked
+ * storage: the page may never have been loaded from the backing file, so
+ * a whole page zeroed there is created as a dirty zero page to get the
+ * file zeroed as well.
+ */
+static int drv_page_update_locked(struct drv_storage * st,
+                                  pgoff_t idx,
+                                  size_t off,
+                                  const char * buf,
+                                  size_t len,
+                                  bool dirty,
+                                  struct drv_prealloc * pre)
+{
+    spinlock_t * lock = drv_slot_lock(st, idx);
+    bool zero_page
+        = !buf && len == PAGE_SIZE && !(st->flags & DRV_STORAGE_PINNED);
+    bool create
+        = buf || (zero_page && (st->flags & DRV_STORAGE_TRACK_DIRTY));
+    struct drv_slot * slot = NULL;
+    int status = 0;
+
+    spin_lock(lock);
+
+    slot = drv_slot_lookup(st, idx);
+    // Zeroing a page that is already zero
+    if (!buf && (slot ? drv_slot_is_zero(slot) : !create))
+        goto out;
+
+    if (!slot)
+        slot = drv_slot_get(st, idx, pre);
+    if (!slot) {
+        status = -ENOMEM;
+        goto out;
+    }
+
+    if (zero_page)
+        drv_slot_store_same(st, slot, 0);
+    else
+        status = drv_slot_update(st, slot, off, buf, len, pre);
+
+    if (!status && dirty)
+        drv_slot_mark_dirty(st, slot);
+
+out:
+    spin_unlock(lock);
+    return status;
+}
+
+
+static int drv_page_update(struct drv_storage * st,
+                           pgoff_t idx,
+                           size_t off,
+                           const char * buf,
+                           size_t len,
+                           bool dirty,
+                           gfp_t gfp)
+{
+    struct drv_prealloc pre = { NULL, NULL };
+    int status = drv_page_update_locked(st, idx, off, buf, len, dirty, &pre);
+
+    if (status == -ENOMEM && gfpflags_allow_blocking(gfp)
+        && !drv_prealloc_fill(st, &pre, idx, gfp)) {
+        status = drv_page_update_locked(st, idx, off, buf, len, dirty, &pre);
+        radix_tree_preload_end();
+    }
+
+    drv_prealloc_free(&pre);
+    return status;
+}
+
+
+static int drv_page_read(struct drv_storage * st,
+                         pgoff_t idx,
+                         size_t off,
+                         char * buf,
+                         size_t len)
+{
+    spinlock_t * lock = drv_slot_lock(st, idx);
+    int status = 0;
+
+    spin_lock(lock);
+    status = drv_slot_load(st, drv_slot_lookup(st, idx), off, buf, len);
+    spin_unlock(lock);
+
+    return status;
+}
+
+
+static int drv_storage_update(struct drv_storage * st,
+                              u64 off,
+                              const char * buf,
+                              size_t len,
+                              bool dirty,
+                              gfp_t gfp)
+{
+    while (len) {
+        size_t page_off = offset_in_page(off);
+        size_t n = min_t(size_t, len, PAGE_SIZE - page_off);
+        int status = drv_page_update(
+            st, off >> PAGE_SHIFT, page_off, buf, n, dirty, gfp);
+
+        if (status)
+            return status;
+
+        off += n;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+int drv_storage_write(struct drv_storage * st,
+                      u64 off,
+                      const char * buf,
+                      size_t len,
+                      gfp_t gfp)
+{
+    return drv_storage_update(st, off, buf, len, true, gfp);
+}
+
+
+int drv_storage_fill(struct drv_storage * st,
+                     u64 off,
+                     const char * buf,
+                     size_t len,
+                     gfp_t gfp)
+{
+    return drv_storage_update(st, off, buf, len, false, gfp);
+}
+
+
+int drv_storage_read(struct drv_storage * st, u64 off, char * buf, size_t len)
+{
+    while (len) {
+        size_t page_off = offset_in_page(off);
+        size_t n = min_t(size_t, len, PAGE_SIZE - page_off);
+        int status = drv_page_read(st, off >> PAGE_SHIFT, page_off, buf, n);
+
+        if (status)
+            return status;
+
+        off += n;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+int drv_storage_discard(struct drv_storage * st, u64 off, u64 len, gfp_t gfp)
+{
+    u64 end = off + len;
+    u64 first = round_up(off, PAGE_SIZE);
+    u64 last = round_down(end, PAGE_SIZE);
+    int status = 0;
+
+    /*
+     * Pinned pages may be mapped and are zeroed in place. Tracked pages
+     * have to stay around until the zeros reach the backing file.
+     */
+    if (st->flags & (DRV_STORAGE_PINNED | DRV_STORAGE_TRACK_DIRTY)) {
+        while (off < end && !status) {
+            size_t page_off = offset_in_page(off);
+            size_t n = min_t(u64, end - off, PAGE_SIZE - page_off);
+
+            status = drv_page_update(
+                st, off >> PAGE_SHIFT, page_off, NULL, n, true, gfp);
+            off += n;
+        }
+        return status;
+    }
+
+    // Range within a single page, nothing can be freed
+    if (first > last)
+        return drv_page_update(
+            st, off >> PAGE_SHIFT, offset_in_page(off), NULL, len, true, gfp);
+
+    if (off < first)
+        status = drv_page_update(st,
+                                 off >> PAGE_SHIFT,
+                                 offset_in_page(off),
+                                 NULL,
+                                 first - off,
+                                 true,
+                                 gfp);
+    if (last < end && !status)
+        status = drv_page_update(
+            st, last >> PAGE_SHIFT, 0, NULL, end - last, true, gfp);
+
+    drv_storage_remove(st, first >> PAGE_SHIFT, last >> PAGE_SHIFT);
+    return status;
+}
+
+
+// Gives dst a reference to the content of the slot of another storage
+static int drv_slot_share(struct drv_storage * dst, struct drv_slot * src)
+{
+    struct drv_slot * slot = kmem_cache_zalloc(slot_cache, GFP_KERNEL);
+    int status = 0;
+
+    if (!slot)
+        return -ENOMEM;
+
+    *slot = *src;
+    if (radix_tree_preload(GFP_KERNEL)) {
+        kmem_cache_free(slot_cache, slot);
+        return -ENOMEM;
+    }
+    spin_lock(&dst->tree_lock);
+    status = radix_tree_insert(&dst->slots, slot->index, slot);
+    spin_unlock(&dst->tree_lock);
+    radix_tree_preload_end();
+
+    if (status) {
+        kmem_cache_free(slot_cache, slot);
+        return status;
+    }
+
+    if (slot->flags & DRV_SLOT_RAW) {
+        get_page(slot->page);
+        atomic64_inc(&dst->stats.raw_pages);
+    } else if (slot->flags & DRV_SLOT_SAME) {
+        atomic64_inc(&dst->stats.same_pages);
+    }
+    if (slot->flags)
+        atomic64_inc(&dst->stats.pages_stored);
+    return 0;
+}
+
+
+int drv_storage_clone(struct drv_storage * dst, struct drv_storage * src)
+{
+    struct drv_slot * slots[DRV_FREE_BATCH];
+    unsigned long start = 0;
+    unsigned int nr_slots = 0;
+    unsigned int i = 0;
+    int status = 0;
+
+    // Compressed objects and mapped pages can not be shared
+    if (src->pool || dst->pool
+        || ((src->flags | dst->flags) & DRV_STORAGE_PINNED))
+        return -EINVAL;
+
+    do {
+        rcu_read_lock();
+        nr_slots = radix_tree_gang_lookup(
+            &src->slots, (void **)slots, start, DRV_FREE_BATCH);
+        rcu_read_unlock();
+
+        // src is quiescent, its slots can not change or go away
+        for (i = 0; i < nr_slots && !status; i++)
+            status = drv_slot_share(dst, slots[i]);
+
+        if (nr_slots)
+            start = slots[nr_slots - 1]->index + 1;
+    } while (nr_slots == DRV_FREE_BATCH && !status);
+
+    return status;
+}
+
+
+static struct page * drv_storage_page_locked(struct drv_storage * st,
+                                             pgoff_t idx,
+                                             struct drv_prealloc * pre)
+{
+    spinlock_t * lock = drv_slot_lock(st, idx);
+    struct drv_slot * slot = NULL;
+    struct page * page = NULL;
+
+    spin_lock(lock);
+    slot = drv_slot_get(st, idx, pre);
+    // An empty store turns a never written slot into a zeroed page
+    if (slot && !drv_slot_store_raw(st, slot, 0, NULL, 0, pre))
+        page = slot->page;
+    spin_unlock(lock);
+
+    return page;
+}
+
+
+struct page * drv_storage_page(struct drv_storage * st, pgoff_t idx, gfp_t gfp)
+{
+    struct drv_prealloc pre = { NULL, NULL };
+    struct page * page = NULL;
+
+    if (WARN_ON(!(st->flags & DRV_STORAGE_PINNED)))
+        return NULL;
+
+    page = drv_storage_page_locked(st, idx, &pre);
+    if (!page && gfpflags_allow_blocking(gfp)
+        && !drv_prealloc_fill(st, &pre, idx, gfp)) {
+        page = drv_storage_page_locked(st, idx, &pre);
+        radix_tree_preload_end();
+    }
+
+    drv_prealloc_free(&pre);
+    return page;
+}
+
+
+void drv_storage_forget(struct drv_storage * st, u64 off, u64 len)
+{
+    drv_storage_remove(st,
+                       DIV_ROUND_UP(off, PAGE_SIZE),
+                       (off + len) >> PAGE_SHIFT);
+}
+
+
+unsigned int drv_storage_dirty(struct drv_storage * st,
+                               pgoff_t start,
+                               pgoff_t * indices,
+                               unsigned int max)
+{
+    struct drv_slot * slots[DRV_STORAGE_DIRTY_BATCH];
+    unsigned int nr_slots = 0;
+    unsigned int i = 0;
+
+    max = min_t(unsigned int, max, DRV_STORAGE_DIRTY_BATCH);
+
+    // Tracked slots are only freed by drv_storage_free() and, never
+    // concurrently with this, drv_storage_forget()
+    rcu_read_lock();
+    nr_slots = radix_tree_gang_lookup_tag(
+        &st->slots, (void **)slots, start, max, DRV_TAG_DIRTY);
+    for (i = 0; i < nr_slots; i++)
+        indices[i] = slots[i]->index;
+    rcu_read_unlock();
+
+    return nr_slots;
+}
+
+
+int drv_storage_clean(struct drv_storage * st, pgoff_t idx, char * buf)
+{
+    spinlock_t * lock = drv_slot_lock(st, idx);
+    struct drv_slot * slot = NULL;
+    int status = 0;
+
+    spin_lock(lock);
+    slot = drv_slot_lookup(st, idx);
+    status = drv_slot_load(st, slot, 0, buf, PAGE_SIZE);
+    if (!status && slot) {
+        spin_lock(&st->tree_lock);
+        radix_tree_tag_clear(&st->slots, idx, DRV_TAG_DIRTY);
+        spin_unlock(&st->tree_lock);
+    }
+    spin_unlock(lock);
+
+    return status;
+}
+
+
+void drv_storage_redirty(struct drv_storage * st, pgoff_t idx)
+{
+    spinlock_t * lock = drv_slot_lock(st, idx);
+    struct drv_slot * slot = NULL;
+
+    spin_lock(lock);
+    slot = drv_slot_lookup(st, idx);
+    if (slot)
+        drv_slot_mark_dirty(st, slot);
+    spin_unlock(lock);
+}
@@ -0,0 +1,139 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <linux/atomic.h>
+#include <linux/radix-tree.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+
+// Number of locks guarding slot contents, must be a power of two
+#define DRV_STORAGE_LOCKS 64
+
+#define DRV_STORAGE_COMPRESS 0x1 // LZ4-compress pages into zsmalloc
+#define DRV_STORAGE_PINNED 0x2 // keep every page raw, in lowmem, until freed
+#define DRV_STORAGE_TRACK_DIRTY 0x4 // remember pages to write back
+#define DRV_STORAGE_INTERLEAVE 0x8 // spread raw pages over the online nodes
+
+// Most dirty pages returned by one drv_storage_dirty() call
+#define DRV_STORAGE_DIRTY_BATCH 64
+
+struct zs_pool;
+struct drv_comp_stream;
+
+struct drv_storage_stats
+{
+    atomic64_t pages_stored; // populated pages, whatever their encoding
+    atomic64_t raw_pages; // pages stored uncompressed
+    atomic64_t compr_data_size; // bytes of compressed objects
+    atomic64_t same_pages; // pages of one repeated word, kept in the slot
+};
+
+/*
+ * Sparse, page-indexed backing store of a ramdisk. A page is allocated
+ * on the first write into it, ranges that were never written read as
+ * zeros. Memory use follows the working set, not the capacity.
+ *
+ * With compression enabled every page is LZ4-compressed into a zsmalloc
+ * object; pages that do not shrink enough are kept as is. Full pages of
+ * a single repeated word (zero pages included) take no memory at all.
+ *
+ * Pinned storage stores every written page raw and never frees or moves
+ * it before drv_storage_free(), so page addresses may be handed out
+ * (DAX). Discard then only zeroes pages.
+ *
+ * Tracking storage tags written pages dirty until they are cleaned by
+ * writeback. Its slots are only dropped by drv_storage_forget() and
+ * drv_storage_free().
+ *
+ * A clone shares the raw pages of its source, each side copies a page
+ * before its first write to it. Shared pages are accounted on every
+ * storage holding them.
+ *
+ * Raw pages are allocated on the node of the CPU serving the write, or
+ * round-robin by page index over the online nodes with interleaving.
+ */
+struct drv_storage
+{
+    struct radix_tree_root slots;
+    spinlock_t tree_lock; // serializes insertions and removals
+    spinlock_t locks[DRV_STORAGE_LOCKS]; // guard slots, hashed by index
+    unsigned int flags;
+    struct zs_pool * pool; // NULL when compression is off
+    struct drv_comp_stream __percpu * streams;
+    int * nodes; // interleave targets, NULL when not interleaving
+    unsigned int nr_nodes;
+    struct drv_storage_stats stats;
+};
+
+
+int drv_storage_module_init(void);
+void drv_storage_module_exit(void);
+
+int drv_storage_init(struct drv_storage * st,
+                     const char * name,
+                     unsigned int flags);
+void drv_storage_free(struct drv_storage * st);
+
+/*
+ * Updating calls first allocate without sleeping. When that fails and
+ * gfp allows blocking, they retry with gfp allocations made outside the
+ * storage locks, otherwise they return -ENOMEM.
+ */
+int drv_storage_write(struct drv_storage * st,
+                      u64 off,
+                      const char * buf,
+                      size_t len,
+                      gfp_t gfp);
+int drv_storage_read(struct drv_storage * st, u64 off, char * buf, size_t len);
+
+// Like drv_storage_write() but leaves the pages clean
+int drv_storage_fill(struct drv_storage * st,
+                     u64 off,
+                     const char * buf,
+                     size_t len,
+                     gfp_t gfp);
+
+/*
+ * Frees pages fully covered by the range and zeroes the partially covered
+ * head and tail, so discarded sectors read back as zeros.
+ */
+int drv_storage_discard(struct drv_storage * st, u64 off, u64 len, gfp_t gfp);
+
+/*
+ * Makes the empty storage dst a copy of src in time proportional to the
+ * populated pages. src must not change meanwhile. Not supported with
+ * compression or pinning.
+ */
+int drv_storage_clone(struct drv_storage * dst, struct drv_storage * src);
+
+/*
+ * Drops the whole pages of the range, dirty ones included, even from
+ * tracked storage. For ranges whose backing copy the caller discards,
+ * serialized with drv_storage_dirty().
+ */
+void drv_storage_forget(struct drv_storage * st, u64 off, u64 len);
+
+// Fills indices with up to max dirty page indices from start, ascending
+unsigned int drv_storage_dirty(struct drv_storage * st,
+                               pgoff_t start,
+                               pgoff_t * indices,
+                               unsigned int max);
+
+// Copies page idx into buf (a full page) and marks it clean
+int drv_storage_clean(struct drv_storage * st, pgoff_t idx, char * buf);
+
+// Marks page idx dirty again after a failed writeback
+void drv_storage_redirty(struct drv_storage * st, pgoff_t idx);
+
+/*
+ * Returns the page backing page index idx, allocating it if needed, or
+ * NULL on allocation failure. Pinned storage only.
+ */
+struct page * drv_storage_page(struct drv_storage * st, pgoff_t idx, gfp_t gfp);
+
+// Memory actually held by the store, in bytes
+u64 drv_storage_mem_used(struct drv_storage * st);
+
+
+#endif